@@ -0,0 +1,5 @@
+let total = 0;
+for i in 0 -> 20000000 {
+  if i < 10 { total = total + i * 2; } else { total = total - 1; }
+}
+print(total);
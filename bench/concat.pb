@@ -0,0 +1,3 @@
+let s = "";
+for i in 0 -> 200000 { s = s + tostring(i) + ","; }
+print(tonumber("1"));
@@ -0,0 +1,5 @@
+let total = 0;
+for i in 0 -> 30000000 {
+  total = total + 1;
+}
+print(total);
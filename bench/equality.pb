@@ -0,0 +1,11 @@
+let hits = 0;
+let name = "alpha";
+let flag = true;
+for i in 0 -> 5000000 {
+  let j = i - 1;
+  if j == i { hits = hits + 1; }
+  if name == "alpha" { hits = hits + 1; }
+  if name != "beta" && flag == true { hits = hits + 1; }
+  let t = i * 2 + 1 > 10 / 2;
+}
+print(hits);
@@ -0,0 +1,7 @@
+let tag = "alpha";
+let n = 0;
+for i in 0 -> 5000000 {
+  if tag == "alpha" { n = n + 1; }
+  if tag != "betaa" { n = n + 1; }
+}
+print(n);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+// bump allocator for things that all die together, there's no freeing single
+// allocations
+typedef struct Arena {
+  struct ArenaBlock *blocks; // newest first
+  char *ptr, *end;
+} Arena;
+
+Arena new_arena();
+void delete_arena(Arena *arena);
+// throws away everything allocated so far, keeping the newest block around
+void reset_arena(Arena *arena);
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
@@ -3,6 +3,9 @@
 #include "chunk.h"
 #include "expr.h"
 #include "registry.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef enum Bytecode {
   Bytecode_PushNull = 0,
@@ -12,9 +15,16 @@ typedef enum Bytecode {
   Bytecode_PushString,
   Bytecode_Copy,
   Bytecode_Pop,
+  // u8 count, only written by peephole_chunk
+  Bytecode_PopN,
 
   Bytecode_Load,
   Bytecode_Store,
+  // same as above with a u16 slot, for when there's more than 256 locals
+  Bytecode_LoadWide,
+  Bytecode_StoreWide,
+  // store followed by a pop, only written by peephole_chunk
+  Bytecode_StorePop,
 
   Bytecode_NativeCall,
 
@@ -32,6 +42,14 @@ typedef enum Bytecode {
   Bytecode_LessEqual,
   Bytecode_Greater,
   Bytecode_GreaterEqual,
+  // equality between operands the parser proved have the same type, every
+  // other arithmetic and comparison op only ever sees numbers already
+  Bytecode_EqualNum,
+  Bytecode_NotEqualNum,
+  Bytecode_EqualBool,
+  Bytecode_NotEqualBool,
+  Bytecode_EqualStr,
+  Bytecode_NotEqualStr,
 
   Bytecode_Concat,
 
@@ -41,7 +59,81 @@ typedef enum Bytecode {
   Bytecode_JumpIfTrue,
   Bytecode_JumpIfFalseRetain,
   Bytecode_JumpIfTrueRetain,
+  // u32 offset forms, only written by relax_chunk
+  Bytecode_JumpLong,
+  Bytecode_JumpBackLong,
+
+  // fused versions of what the parser emits for loops and conditions, the
+  // JumpIfNot* family pops both operands and jumps when the comparison fails
+  Bytecode_AddLocalConst,
+  Bytecode_IncLocalAndLoop,
+
+  Bytecode_JumpIfNotEqual,
+  Bytecode_JumpIfEqual,
+  Bytecode_JumpIfNotEqualNum,
+  Bytecode_JumpIfEqualNum,
+  Bytecode_JumpIfNotEqualBool,
+  Bytecode_JumpIfEqualBool,
+  Bytecode_JumpIfNotEqualStr,
+  Bytecode_JumpIfEqualStr,
+  Bytecode_JumpIfNotLess,
+  Bytecode_JumpIfNotLessEqual,
+  Bytecode_JumpIfNotGreater,
+  Bytecode_JumpIfNotGreaterEqual,
+
+  Bytecode_JumpIfNotLessLocalConst,
+  Bytecode_JumpIfNotLessEqualLocalConst,
+  Bytecode_JumpIfNotGreaterLocalConst,
+  Bytecode_JumpIfNotGreaterEqualLocalConst,
+
+  // pops the script's result and stops
+  Bytecode_Return,
+
+  // never written to a chunk, decode_chunk ends every program with it
+  Bytecode_Halt,
 } Bytecode;
 
+// fixed-width form of a single instruction, operands that are spread across
+// the byte stream get unpacked into naturally aligned fields
+typedef struct Instruction {
+  uint16_t op;
+  uint16_t arg;      // native call argument count or a fused local slot
+  uint32_t operand;  // slot/string/native index, or jump target instruction
+  uint32_t constant; // index into Program::numbers
+} Instruction;
+
+typedef struct Program {
+  size_t size;
+  Instruction *code;
+
+  size_t numbers_num, numbers_cap;
+  double *numbers;
+} Program;
+
 void compile_expr(Chunk *chunk, const Expr *expr);
-void disassemble_chunk(const Chunk *chunk, const Registry *registry);
\ No newline at end of file
+// compiles an expression statement, leaving nothing on the stack
+void compile_discarded_expr(Chunk *chunk, const Expr *expr);
+// compiles a condition along with a jump taken when it's false, returns the
+// jump's hole
+size_t compile_jump_if_false(Chunk *chunk, const Expr *cond);
+// widens the jumps patching found too far for a u16 offset, small chunks are
+// left alone
+void relax_chunk(Chunk *chunk);
+// cleans up what the parser leaves behind one statement at a time: values
+// pushed just to be popped, a store and pop per assignment, pops one by one
+// at the end of a block and jumps onto other jumps. runs after relax_chunk,
+// and adds what it took out to the chunk's peephole counts
+void peephole_chunk(Chunk *chunk);
+void disassemble_chunk(const Chunk *chunk, const Registry *registry);
+
+// how many bytes an instruction takes up in a chunk, opcode included, 0 for
+// anything that isn't an opcode
+size_t bytecode_size(Bytecode op);
+// checks a chunk from somewhere untrusted before it gets decoded: known
+// opcodes, operands in range, jumps landing on instructions and a stack that
+// agrees on every path, with nothing popped or addressed past the top and
+// every operand the vms read without a tag check proven to be the right type
+bool verify_chunk(const Chunk *chunk, const Registry *registry);
+
+Program decode_chunk(const Chunk *chunk);
+void delete_program(Program *program);
\ No newline at end of file
@@ -1,19 +1,38 @@
 #pragma once
 
+#include "type_def.h"
+#include "value.h"
 #include <stddef.h>
 #include <stdint.h>
 
-typedef struct ChunkString {
-  uint32_t len;
-  char *chars;
-} ChunkString;
+// a jump patched with an offset too big for its u16
+typedef struct ChunkFarJump {
+  size_t hole;   // where the offset would have gone
+  size_t target; // byte offset the jump lands on
+} ChunkFarJump;
 
 typedef struct Chunk {
+  // interned strings, pushing one doesn't allocate
   size_t strings_num;
-  ChunkString *strings;
+  Value *strings;
+  // open addressed index into strings by string hash, 0 is empty and anything
+  // else is the string index + 1
+  size_t string_slots_cap;
+  uint32_t *string_slots;
 
   size_t size, cap;
   uint8_t *code;
+
+  // variables the host fills in before running, they take the first slots
+  size_t args_num;
+  TypeDef *arg_types;
+
+  // left for relax_chunk to widen, empty unless the code is huge
+  size_t far_jumps_num, far_jumps_cap;
+  ChunkFarJump *far_jumps;
+
+  // what peephole_chunk took out, only kept for reporting
+  size_t peephole_instructions, peephole_bytes;
 } Chunk;
 
 Chunk new_chunk();
@@ -42,4 +61,8 @@ void write_chunk_f32(Chunk *chunk, float value);
 void write_chunk_f64(Chunk *chunk, double value);
 
 size_t write_chunk_hole(Chunk *chunk, size_t bits);
-void patch_chunk_hole_u16(Chunk *chunk, size_t pos);
\ No newline at end of file
+// both record the jump as far instead when the offset doesn't fit
+void patch_chunk_hole_u16(Chunk *chunk, size_t pos);
+void write_chunk_back_offset_u16(Chunk *chunk, size_t target);
+// throws away everything written from size on, the strings stay
+void truncate_chunk(Chunk *chunk, size_t size);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arena.h"
 #include "lexer.h"
 #include "type_def.h"
 #include "value.h"
@@ -39,6 +40,8 @@ typedef enum BinaryOp {
 } BinaryOp;
 
 struct ExprList;
+// exprs are allocated from an arena and literal strings are interned, so a
+// tree never has to be freed node by node
 typedef struct Expr {
   ExprType type;
   TypeDef return_type;
@@ -71,13 +74,18 @@ typedef struct Expr {
 
 BinaryOp token_to_binary_op(TokenType type);
 
-Expr *new_expr(ExprType type, TypeDef return_type);
-Expr *new_literal_expr(Value value);
-Expr *new_get_var_expr(size_t idx, TypeDef type);
-Expr *new_set_var_expr(size_t idx, Expr *value);
-Expr *new_native_call_expr(size_t idx, TypeDef return_type, Expr *argv_head);
-Expr *new_unary_expr(UnaryOp op, Expr *operand);
-Expr *new_binary_expr(BinaryOp op, Expr *lhs, Expr *rhs);
-void delete_expr(Expr *expr);
+Expr *new_expr(Arena *arena, ExprType type, TypeDef return_type);
+Expr *new_literal_expr(Arena *arena, Value value);
+Expr *new_get_var_expr(Arena *arena, size_t idx, TypeDef type);
+Expr *new_set_var_expr(Arena *arena, size_t idx, Expr *value);
+Expr *new_native_call_expr(Arena *arena, size_t idx, TypeDef return_type,
+                           Expr *argv_head);
+Expr *new_unary_expr(Arena *arena, UnaryOp op, Expr *operand);
+Expr *new_binary_expr(Arena *arena, BinaryOp op, Expr *lhs, Expr *rhs);
 
+// folds a single node whose operands are already folded: literals into
+// literals, identities like x * 1 into their operand and and/or with a
+// constant side into whichever side decides it
+void fold_expr(Expr *expr);
+// folds a whole tree bottom up
 void simplify_expr(Expr *expr);
\ No newline at end of file
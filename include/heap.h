@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+
+// small allocations are rounded up to one of these sizes and carved out of
+// slabs, anything bigger goes to malloc
+enum {
+  HEAP_CLASSES_NUM = 8,
+  HEAP_MAX_CLASS_SIZE = 256,
+  HEAP_SLAB_SIZE = 64 * 1024,
+};
+
+typedef struct HeapStats {
+  size_t allocs, frees;
+  size_t large_allocs; // allocations too big for any size class
+  size_t live_bytes, peak_bytes;
+  size_t slabs_num;
+} HeapStats;
+
+typedef struct HeapClass {
+  struct HeapBlock *free_list;
+  // unused tail of the newest slab of this class
+  char *bump, *bump_end;
+} HeapClass;
+
+typedef struct Heap {
+  HeapClass classes[HEAP_CLASSES_NUM];
+  struct HeapSlab *slabs;
+  struct HeapLarge *large;
+
+  HeapStats stats;
+} Heap;
+
+// heaps don't move once made, every slab points back at its heap so memory
+// can be freed without knowing where it came from
+Heap *new_heap();
+// releases everything allocated from the heap at once
+void delete_heap(Heap *heap);
+
+void *heap_alloc(Heap *heap, size_t size);
+// size has to match what the memory was allocated with
+void heap_free(void *ptr, size_t size);
+
+HeapStats get_heap_stats(const Heap *heap);
+
+// where objects get allocated on the calling thread, each thread has its own
+// current and default heap. a heap is only ever used by one thread at a time
+Heap *get_current_heap();
+// returns the previous current heap so it can be restored
+Heap *set_current_heap(Heap *heap);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "value.h"
+#include <stdint.h>
+
+// strings interned here are immortal and unique, two interned strings are
+// equal exactly when they're the same object
+Value intern_string(const char *chars, uint32_t len);
+void free_interned_strings();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum TokenType {
   TokenType_Error = -1,
@@ -50,6 +51,7 @@ typedef enum TokenType {
   TokenType_By,
   TokenType_Break,
   TokenType_Continue,
+  TokenType_Return,
 
   TokenType_Number,
   TokenType_Identifier,
@@ -72,16 +74,39 @@ typedef struct Token {
   };
 } Token;
 
+// how buffered lexers keep their tokens, text is stored as an offset into the
+// source
+typedef struct PackedToken {
+  int32_t type;
+  uint32_t len;
+  union {
+    uint32_t offset;
+    double number;
+  };
+} PackedToken;
+
 typedef struct Lexer {
   const char *source;
+  size_t len;
   size_t pos;
 
   LexerContext context;
 
   Token token;
+
+  // only set for buffered lexers, which go over the whole source up front and
+  // then just step through this
+  PackedToken *tokens;
+  size_t tokens_num;
+  size_t token_idx;
 } Lexer;
 
-Lexer new_lexer(const char *source);
+// source doesn't need to be nul terminated, len is where it ends
+// makes one token at a time as the parser asks for them
+Lexer new_lexer(const char *source, size_t len);
+// tokenizes everything in one pass
+Lexer new_buffered_lexer(const char *source, size_t len);
+void delete_lexer(Lexer *lexer);
 
 Token lexer_peek(const Lexer *lexer);
 Token lexer_advance(Lexer *lexer);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "expr.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the parser compiles a statement at a time, so instead of a pass over a
+// whole tree the optimizer rewrites every expression right before it gets
+// compiled, using what it has been told about the variables in scope
+
+enum { ASSIGNED_NAME_BITS = 4096 };
+
+typedef enum VarFactType {
+  VarFactType_Unknown = 0,
+  VarFactType_Literal,
+  VarFactType_Copy,
+} VarFactType;
+
+// what a variable holds for as long as it exists
+typedef struct VarFact {
+  VarFactType type;
+  // never assigned after being declared
+  bool immutable;
+  union {
+    Value literal;  // strings are interned
+    size_t copy_of; // another immutable variable
+  };
+} VarFact;
+
+typedef struct Optimizer {
+  // names assigned anywhere in the script, a bit per name hash. collisions
+  // only ever make the optimizer more careful
+  uint64_t assigned_names[ASSIGNED_NAME_BITS / 64];
+
+  // by variable slot
+  VarFact *facts;
+  size_t facts_cap;
+} Optimizer;
+
+// goes over the whole script up front, a single pass parser can't otherwise
+// tell whether a variable gets assigned further down
+Optimizer new_optimizer(const char *source, size_t len);
+void delete_optimizer(Optimizer *optimizer);
+
+bool is_name_assigned(const Optimizer *optimizer, const char *name,
+                      size_t name_len);
+// forgets whatever was known about the slot
+void declare_optimizer_var(Optimizer *optimizer, size_t idx, bool immutable);
+// remembers what an immutable variable starts out as, value should have been
+// through optimize_expr
+void init_optimizer_var(Optimizer *optimizer, size_t idx, const Expr *value);
+
+// rewrites expr in place, replacing immutable variables with what they hold
+// and folding the result
+void optimize_expr(const Optimizer *optimizer, Expr *expr);
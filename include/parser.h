@@ -1,6 +1,14 @@
 #pragma once
 
 #include "chunk.h"
+#include "reg_chunk.h"
 #include "registry.h"
+#include <stddef.h>
 
-Chunk compile_script(const char *source, const Registry *registry);
\ No newline at end of file
+Chunk compile_script(const char *source, size_t len, const Registry *registry);
+// same as above, with variables the host fills in on every run, declared like
+// "number count, string name"
+Chunk compile_script_args(const char *source, size_t len,
+                          const Registry *registry, const char *args);
+RegChunk compile_script_reg(const char *source, size_t len,
+                            const Registry *registry);
\ No newline at end of file
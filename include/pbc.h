@@ -0,0 +1,18 @@
+#pragma once
+
+#include "chunk.h"
+#include "registry.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// compiled stack bytecode saved to disk, so a script that hasn't changed can
+// skip straight to running
+enum { PBC_VERSION = 7 };
+
+// both return false on failure, a missing or stale file isn't an error
+bool write_pbc(const char *path, const Chunk *chunk, const Registry *registry,
+               const char *source, size_t source_len);
+// only succeeds if the file was written for this exact source and every
+// native it calls is registered with the same signature
+bool load_pbc(const char *path, const char *source, size_t source_len,
+              const Registry *registry, Chunk *out_chunk);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "expr.h"
+#include "reg_chunk.h"
+#include "registry.h"
+#include <stdint.h>
+
+// marks an instruction result that nobody reads
+enum { REG_NONE = UINT16_MAX };
+
+// three-address code, `a` is the destination register unless noted otherwise
+// and the K variants take a number constant as their right hand side
+typedef enum RegBytecode {
+  RegBytecode_LoadNull = 0, // a
+  RegBytecode_LoadBoolean,  // a, b = boolean
+  RegBytecode_LoadNumber,   // a, b = number constant
+  RegBytecode_LoadString,   // a, b = string constant
+  RegBytecode_Move,         // a, b
+
+  RegBytecode_NativeCall, // a, b = native fn, c = first argument, argc
+
+  RegBytecode_Negate, // a, b
+  RegBytecode_Not,    // a, b
+
+  RegBytecode_Add, // a, b, c
+  RegBytecode_Subtract,
+  RegBytecode_Multiply,
+  RegBytecode_Divide,
+
+  RegBytecode_AddK, // a, b, c = number constant
+  RegBytecode_SubtractK,
+  RegBytecode_MultiplyK,
+  RegBytecode_DivideK,
+
+  RegBytecode_Equal, // a, b, c
+  RegBytecode_NotEqual,
+  RegBytecode_Less,
+  RegBytecode_LessEqual,
+  RegBytecode_Greater,
+  RegBytecode_GreaterEqual,
+  // equality between operands proven to be the same type
+  RegBytecode_EqualNum,
+  RegBytecode_NotEqualNum,
+  RegBytecode_EqualBool,
+  RegBytecode_NotEqualBool,
+  RegBytecode_EqualStr,
+  RegBytecode_NotEqualStr,
+
+  RegBytecode_LessK, // a, b, c = number constant
+  RegBytecode_LessEqualK,
+  RegBytecode_GreaterK,
+  RegBytecode_GreaterEqualK,
+
+  RegBytecode_Concat, // a, b, c
+
+  RegBytecode_Jump,        // b = target
+  RegBytecode_JumpIfFalse, // a = condition, b = target
+  RegBytecode_JumpIfTrue,  // a = condition, b = target
+
+  RegBytecode_Return, // a = result
+
+  RegBytecode_Halt,
+} RegBytecode;
+
+// registers below `temp` belong to variables (or whoever called us), anything
+// from `temp` upwards is free to use as scratch space
+void compile_reg_expr(RegChunk *chunk, const Expr *expr, uint16_t dest,
+                      uint16_t temp);
+void disassemble_reg_chunk(const RegChunk *chunk, const Registry *registry);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "chunk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct RegInstruction {
+  uint8_t op;
+  uint8_t argc;
+  uint16_t a;  // usually the destination register
+  uint32_t b;  // register, constant index or jump target
+  uint32_t c;  // register or constant index
+} RegInstruction;
+
+typedef struct RegChunk {
+  // only the string pool of this one is used, so string constants go through
+  // the same helpers as the stack chunk
+  Chunk constants;
+
+  size_t numbers_num;
+  double *numbers;
+
+  size_t size, cap;
+  RegInstruction *code;
+
+  // how many registers the code touches, variables included
+  size_t regs_num;
+} RegChunk;
+
+RegChunk new_reg_chunk();
+void delete_reg_chunk(RegChunk *chunk);
+
+size_t add_reg_chunk_string(RegChunk *chunk, const char *chars, uint32_t len);
+size_t add_reg_chunk_number(RegChunk *chunk, double number);
+void reserve_reg_chunk_regs(RegChunk *chunk, size_t regs_num);
+
+size_t write_reg_chunk(RegChunk *chunk, RegInstruction instruction);
+void patch_reg_chunk_jump(RegChunk *chunk, size_t pos);
+// throws away every instruction from size on
+void truncate_reg_chunk(RegChunk *chunk, size_t size);
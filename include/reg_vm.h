@@ -0,0 +1,32 @@
+#pragma once
+
+#include "heap.h"
+#include "reg_chunk.h"
+#include "registry.h"
+#include "value.h"
+#include <stddef.h>
+
+typedef struct RegVm {
+  const RegChunk *chunk;
+  const Registry *registry;
+
+  Value *regs;
+  size_t pc;
+
+  // set when the script was stopped by a runtime error, NULL otherwise
+  const char *error;
+  // what the script returned, null if it ran off the end
+  Value result;
+
+  // objects made while running come from here, deleting the vm releases
+  // them all at once
+  Heap *heap;
+
+  // only counted when built with VM_STATS
+  size_t executed;
+} RegVm;
+
+RegVm new_reg_vm(const RegChunk *chunk, const Registry *registry);
+void delete_reg_vm(RegVm *vm);
+
+Value run_reg_vm(RegVm *vm);
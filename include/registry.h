@@ -12,6 +12,11 @@ typedef Value (*NativeFnPtr)(struct Vm *vm, size_t argc, Value argv[]);
 typedef struct NativeFn {
   TypeDef return_type;
   char *name;
+  size_t name_len;
+  uint32_t name_hash;
+  // exactly as registered, compiled bytecode saved to disk is checked against
+  // it
+  char *signature;
 
   size_t args_num;
   TypeDef *arg_types;
@@ -21,11 +26,20 @@ typedef struct NativeFn {
 } NativeFn;
 
 typedef struct Registry {
-  size_t native_fns_num;
+  size_t native_fns_num, native_fns_cap;
   NativeFn *native_fns;
+
+  // open addressed index into native_fns by name hash, 0 is empty and
+  // anything else is the function index + 1
+  size_t slots_cap;
+  uint32_t *slots;
 } Registry;
 
 Registry new_registry();
 void delete_registry(Registry *registry);
 
-void register_native_fn(Registry *registry, const char *sig, NativeFnPtr ptr);
\ No newline at end of file
+void register_native_fn(Registry *registry, const char *sig, NativeFnPtr ptr);
+// doesn't modify the registry, so it can be shared once everything's
+// registered
+const NativeFn *find_native_fn(const Registry *registry, const char *name,
+                               size_t name_len, size_t *out_idx);
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "chunk.h"
+#include "heap.h"
+#include "registry.h"
+#include "value.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// how scripts run across threads:
+// - a compiled Chunk and its Registry are read-only once built, any number of
+//   vms on any threads can share them
+// - everything a vm makes comes from its own heap and stays there, so ref
+//   counts are only ever touched by the thread running that vm
+// - strings in a chunk are interned and immortal, nobody writes to them
+// - values handed to more than one vm, like job arguments, have to be
+//   primitives or immortal strings
+// - interning takes a lock and only happens while compiling, the current
+//   heap and the live value count are per thread
+
+typedef struct RunnerJob {
+  const Value *args;
+  size_t args_num;
+} RunnerJob;
+
+// called on the worker that ran the job, the result and error are only valid
+// until it returns
+typedef void (*RunnerResultFn)(void *user, size_t job_idx, Value result,
+                               const char *error);
+
+typedef struct BatchStats {
+  size_t errors;
+  size_t steals; // job ranges taken from another worker
+  // wall time of a single job, from start to result
+  uint64_t mean_ns, p50_ns, p90_ns, p99_ns, p999_ns, max_ns;
+} BatchStats;
+
+// everything a batch produced, indexed like the jobs
+typedef struct Batch {
+  size_t jobs_num;
+  // strings are copied out of the vms into heaps owned by the batch, so
+  // results stay valid until the batch is deleted
+  Value *results;
+  const char **errors; // NULL for jobs that ran fine
+  uint64_t *latencies_ns;
+  BatchStats stats;
+
+  size_t heaps_num;
+  Heap **heaps; // one per worker
+} Batch;
+
+// a fixed set of worker threads, each with its own vm for the same chunk.
+// every batch starts out split evenly between the workers, one that runs out
+// steals half of what's left of somebody else's share
+typedef struct Runner {
+  const Chunk *chunk;
+  const Registry *registry;
+
+  size_t workers_num;
+  struct RunnerWorker *workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t batch_ready, batch_done;
+  size_t batch_id;
+  size_t busy_workers;
+  bool stopping;
+
+  // the batch being run, results go to the callback or into the batch
+  const RunnerJob *jobs;
+  size_t jobs_num;
+  RunnerResultFn on_result;
+  void *user;
+  Batch *batch;
+  atomic_size_t steals;
+} Runner;
+
+// runners don't move once made, their workers point back at them
+Runner *new_runner(const Chunk *chunk, const Registry *registry,
+                   size_t workers_num);
+void delete_runner(Runner *runner);
+
+// runs every job across the workers and waits for all of them, on_result may
+// be NULL
+void runner_run(Runner *runner, const RunnerJob *jobs, size_t jobs_num,
+                RunnerResultFn on_result, void *user);
+// same, collecting results in job order along with latency percentiles
+Batch run_batch(Runner *runner, const RunnerJob *jobs, size_t jobs_num);
+void delete_batch(Batch *batch);
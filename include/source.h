@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// script text handed to the compiler, not nul terminated
+typedef struct Source {
+  const char *chars;
+  size_t len;
+  bool mapped; // otherwise it was read into a malloc'd buffer
+} Source;
+
+// maps the file straight into memory
+Source load_source_file(const char *path);
+// for things that can't be mapped, like pipes
+Source read_source(FILE *file);
+void delete_source(Source *source);
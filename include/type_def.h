@@ -32,5 +32,8 @@ bool is_type_def_boolean(TypeDef def);
 bool is_type_def_string(TypeDef def);
 
 bool compare_type_def(TypeDef lhs, TypeDef rhs);
+// the type values of both defs are guaranteed to have at runtime, or
+// ValueType_Error when that isn't known statically
+ValueType common_type_def(TypeDef lhs, TypeDef rhs);
 
 TypeDef parse_type_def(Lexer *lexer);
\ No newline at end of file
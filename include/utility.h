@@ -2,6 +2,11 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 bool compare_string(const char *lhs, size_t lhs_len, const char *rhs,
-                    size_t rhs_len);
\ No newline at end of file
+                    size_t rhs_len);
+
+// never returns 0, so callers can use it to mean "not hashed yet"
+uint32_t hash_string(const char *chars, size_t len);
+uint64_t hash_bytes64(const void *bytes, size_t len);
@@ -1,19 +1,60 @@
 #pragma once
 
 #include "type_def.h"
+#include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
+// objects whose count reaches this are never freed by release_value, either
+// because they're owned elsewhere (chunk constants) or because the count would
+// otherwise overflow
+enum { REF_COUNT_IMMORTAL = UINT32_MAX };
+
+// objects come from the current heap (see heap.h) and go back to whichever
+// heap they were allocated from
 typedef struct Obj {
-  uint16_t ref_count;
+  uint32_t ref_count;
 } Obj;
 
+struct StringBuffer;
+
+// strings never change after being created, anything that wants a different
+// string makes a new one, so they're shared freely between values
 typedef struct ObjString {
-  uint16_t ref_count;
+  uint32_t ref_count;
   uint32_t len;
-  char *chars;
+  uint32_t hash; // 0 until string_hash computes it
+  bool interned;
+  // set for strings built by value_concat, their characters live in this
+  // growable buffer instead of chars so appending to them is cheap
+  struct StringBuffer *buffer;
+  char chars[]; // stored right after the header, nul terminated
 } ObjString;
 
+// concatenations up to this long are copied into a plain string rather than
+// a growable buffer
+enum { SMALL_STRING_MAX = 15 };
+
+#ifdef VALUE_NAN_BOXING
+// numbers are stored as plain doubles, everything else is packed into the
+// payload of a quiet NaN, go through the accessors below to read one
+typedef struct Value {
+  uint64_t bits;
+} Value;
+
+// a quiet NaN with one more payload bit set, no arithmetic ever produces this
+#define VALUE_QNAN ((uint64_t)0x7ffc000000000000)
+// objects additionally have the sign bit set, the pointer goes in the low bits
+#define VALUE_OBJECT_BITS ((uint64_t)0xfffc000000000000)
+
+enum {
+  ValueTag_Null = 1,
+  ValueTag_False,
+  ValueTag_True,
+};
+#else
 typedef struct Value {
   ValueType type;
   union {
@@ -23,27 +64,123 @@ typedef struct Value {
     ObjString *string;
   };
 } Value;
+#endif
+
+uint32_t get_active_values(); // ref counter test, counts this thread only
+
+// primitives are made inline, the vm makes one for almost every instruction
+#ifdef VALUE_NAN_BOXING
+static inline Value new_null_value() {
+  return (Value){
+      .bits = VALUE_QNAN | ValueTag_Null,
+  };
+}
+
+static inline Value new_number_value(double number) {
+  // NaNs with a payload could be mistaken for a boxed value
+  if (isnan(number))
+    number = NAN;
+
+  Value value;
+  memcpy(&value.bits, &number, sizeof(value.bits));
+  return value;
+}
 
-uint32_t get_active_values(); // ref counter test
+static inline Value new_boolean_value(bool boolean) {
+  return (Value){
+      .bits = VALUE_QNAN | (boolean ? ValueTag_True : ValueTag_False),
+  };
+}
+#else
+static inline Value new_null_value() {
+  return (Value){
+      .type = ValueType_Null,
+  };
+}
+
+static inline Value new_number_value(double number) {
+  return (Value){
+      .type = ValueType_Number,
+      .number = number,
+  };
+}
 
-Value new_null_value();
-Value new_number_value(double number);
-Value new_boolean_value(bool boolean);
-Value new_string_value_move(char *chars, uint32_t len);
+static inline Value new_boolean_value(bool boolean) {
+  return (Value){
+      .type = ValueType_Boolean,
+      .boolean = boolean,
+  };
+}
+#endif
+// the caller fills in the len characters at chars before using the value
+Value new_blank_string_value(uint32_t len, char **chars);
 Value new_string_value(const char *chars, uint32_t len);
 Value new_c_string_value(const char *str);
 
+// owned by the caller instead of its references, free with
+// delete_immortal_value. read-only once made, so safe to share across threads
+Value new_immortal_string_value(const char *chars, uint32_t len);
+void delete_immortal_value(Value value);
+
+// wraps an existing string, doesn't add a reference
+Value new_string_object_value(ObjString *string);
+
 void reference_value(Value value);
 void release_value(Value value);
 
+// returns another reference to the same value, release it when done
 Value copy_value(Value value);
 
+ValueType value_type(Value value);
 bool is_value_primitive(Value value);
 double value_as_number(Value value);
 bool value_as_boolean(Value value);
 ObjString *value_as_string(Value value);
+// not necessarily nul terminated, value_as_c_string makes sure of that
+const char *string_chars(const ObjString *string);
 const char *value_as_c_string(Value value);
+uint32_t string_hash(ObjString *string);
+
+// for values whose type the compiler has already proven, unlike value_as_*
+// these are inlined and only check the tag in debug builds
+#ifdef VALUE_NAN_BOXING
+static inline double proven_number(Value value) {
+  assert(value_type(value) == ValueType_Number);
+  double number;
+  memcpy(&number, &value.bits, sizeof(number));
+  return number;
+}
+
+static inline bool proven_boolean(Value value) {
+  assert(value_type(value) == ValueType_Boolean);
+  return value.bits == (VALUE_QNAN | ValueTag_True);
+}
+
+static inline ObjString *proven_string(Value value) {
+  assert(value_type(value) == ValueType_String);
+  return (ObjString *)(uintptr_t)(value.bits & ~VALUE_OBJECT_BITS);
+}
+#else
+static inline double proven_number(Value value) {
+  assert(value_type(value) == ValueType_Number);
+  return value.number;
+}
+
+static inline bool proven_boolean(Value value) {
+  assert(value_type(value) == ValueType_Boolean);
+  return value.boolean;
+}
+
+static inline ObjString *proven_string(Value value) {
+  assert(value_type(value) == ValueType_String);
+  return value.string;
+}
+#endif
 
 bool value_compare(Value lhs, Value rhs);
+// same as value_compare for two strings
+bool string_compare(const ObjString *lhs, const ObjString *rhs);
 
-Value value_concat(Value lhs, Value rhs);
+// false when the result would be longer than a string can be, nothing is made
+// then
+bool value_concat(Value lhs, Value rhs, Value *out);
@@ -1,19 +1,53 @@
 #pragma once
 
+#include "bytecode.h"
 #include "chunk.h"
+#include "heap.h"
 #include "registry.h"
 #include "value.h"
 #include <stddef.h>
 
+enum { VM_STACK_INITIAL = 128 };
+enum { VM_STACK_MAX = 1 << 20 };
+
 typedef struct Vm {
   const Chunk *chunk;
   const Registry *registry;
 
-  Value stack[128];
-  size_t sp;
+  Program program;
+#ifdef VM_THREADED_DISPATCH
+  // handler address for each instruction in the program
+  const void **handlers;
+#endif
+
+  // grows on demand up to stack_max values, going past that stops the script
+  // with an error
+  Value *stack;
+  size_t sp, stack_cap, stack_max;
   size_t pc;
+
+  // set when the script was stopped by a runtime error, NULL otherwise
+  const char *error;
+  // what the script returned, null if it ran off the end
+  Value result;
+
+  // objects made while running come from here, deleting the vm releases
+  // them all at once
+  Heap *heap;
+
+  // only counted when built with VM_STATS
+  size_t executed;
 } Vm;
 
 Vm new_vm(const Chunk *chunk, const Registry *registry);
+void delete_vm(Vm *vm);
 
-Value run_vm(Vm *vm);
\ No newline at end of file
+// the result belongs to the vm and stays valid until it's reset or deleted
+Value run_vm(Vm *vm);
+// fills the variables declared by compile_script_args in order, then runs.
+// args have to match the declared types, a null is fine for an optional one.
+// the vm has to be fresh or reset
+Value run_vm_args(Vm *vm, const Value *args, size_t args_num);
+// puts the vm back at the start of the script for another run, letting go of
+// everything the last one left behind. the decoded program stays
+void reset_vm(Vm *vm);
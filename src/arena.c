@@ -0,0 +1,82 @@
+#include "arena.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { ARENA_MIN_BLOCK_SIZE = 4096 };
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;
+  max_align_t data[];
+} ArenaBlock;
+
+Arena new_arena() {
+  return (Arena){
+      .blocks = NULL,
+      .ptr = NULL,
+      .end = NULL,
+  };
+}
+
+void delete_arena(Arena *arena) {
+  for (ArenaBlock *block = arena->blocks; block != NULL;) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  *arena = new_arena();
+}
+
+void reset_arena(Arena *arena) {
+  ArenaBlock *newest = arena->blocks;
+  if (newest == NULL)
+    return;
+
+  // blocks only grow, so the newest one is also the biggest
+  for (ArenaBlock *block = newest->next; block != NULL;) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  newest->next = NULL;
+  arena->ptr = (char *)newest->data;
+  arena->end = arena->ptr + newest->size;
+}
+
+static void add_block(Arena *arena, size_t min_size) {
+  size_t size = ARENA_MIN_BLOCK_SIZE;
+  if (arena->blocks != NULL)
+    size = arena->blocks->size * 2;
+  while (size < min_size)
+    size *= 2;
+
+  ArenaBlock *block = malloc(sizeof(*block) + size);
+  assert(block != NULL);
+  block->next = arena->blocks;
+  block->size = size;
+  arena->blocks = block;
+  arena->ptr = (char *)block->data;
+  arena->end = arena->ptr + size;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  // keep every allocation aligned for any type
+  size_t align = _Alignof(max_align_t);
+  size = (size + align - 1) & ~(align - 1);
+
+  if ((size_t)(arena->end - arena->ptr) < size)
+    add_block(arena, size);
+
+  void *ptr = arena->ptr;
+  arena->ptr += size;
+  return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  memcpy(copy, str, len);
+  copy[len] = 0;
+  return copy;
+}
@@ -5,14 +5,47 @@
 #include "type_def.h"
 #include "value.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+// the short form covers almost every script, so only pay for the wide one
+// when the slot doesn't fit
+static void write_slot_op(Chunk *chunk, Bytecode op, Bytecode wide_op,
+                          size_t slot) {
+  assert(slot <= UINT16_MAX);
+  if (slot <= UINT8_MAX) {
+    write_chunk_u8(chunk, op);
+    write_chunk_u8(chunk, slot);
+  } else {
+    write_chunk_u8(chunk, wide_op);
+    write_chunk_u16(chunk, slot);
+  }
+}
+
+// picks the form of an equality op specialized to the operands' type, when
+// the parser could prove one
+static Bytecode typed_equality(const Expr *expr, Bytecode num, Bytecode boolean,
+                               Bytecode string, Bytecode any) {
+  switch (common_type_def(expr->binary.lhs->return_type,
+                          expr->binary.rhs->return_type)) {
+  case ValueType_Number:
+    return num;
+  case ValueType_Boolean:
+    return boolean;
+  case ValueType_String:
+    return string;
+  default:
+    return any;
+  }
+}
 
 void compile_expr(Chunk *chunk, const Expr *expr) {
   switch (expr->type) {
   case ExprType_Literal:
-    switch (expr->literal.type) {
+    switch (value_type(expr->literal)) {
     case ValueType_Error:
     case ValueType_Void:
       assert(0);
@@ -21,15 +54,15 @@ void compile_expr(Chunk *chunk, const Expr *expr) {
       break;
     case ValueType_Number:
       write_chunk_u8(chunk, Bytecode_PushNumber);
-      write_chunk_f64(chunk, expr->literal.number);
+      write_chunk_f64(chunk, value_as_number(expr->literal));
       break;
     case ValueType_Boolean:
-      write_chunk_u8(chunk, (expr->literal.boolean) ? Bytecode_PushTrue
+      write_chunk_u8(chunk, value_as_boolean(expr->literal) ? Bytecode_PushTrue
                                                     : Bytecode_PushFalse);
       break;
     case ValueType_String: {
-      size_t idx = add_chunk_string(chunk, expr->literal.string->chars,
-                                    expr->literal.string->len);
+      ObjString *string = value_as_string(expr->literal);
+      size_t idx = add_chunk_string(chunk, string_chars(string), string->len);
       write_chunk_u8(chunk, Bytecode_PushString);
       write_chunk_u16(chunk, idx);
       break;
@@ -37,14 +70,13 @@ void compile_expr(Chunk *chunk, const Expr *expr) {
     }
     break;
   case ExprType_GetVar:
-    write_chunk_u8(chunk, Bytecode_Load);
-    write_chunk_u8(chunk, expr->get_var.idx);
+    write_slot_op(chunk, Bytecode_Load, Bytecode_LoadWide,
+                  expr->get_var.idx);
     break;
   case ExprType_SetVar:
     compile_expr(chunk, expr->set_var.value);
-
-    write_chunk_u8(chunk, Bytecode_Store);
-    write_chunk_u8(chunk, expr->set_var.idx);
+    write_slot_op(chunk, Bytecode_Store, Bytecode_StoreWide,
+                  expr->set_var.idx);
     break;
 
   case ExprType_NativeCall: {
@@ -98,10 +130,15 @@ void compile_expr(Chunk *chunk, const Expr *expr) {
       break;
 
     case BinaryOp_Equal:
-      write_chunk_u8(chunk, Bytecode_Equal);
+      write_chunk_u8(chunk, typed_equality(expr, Bytecode_EqualNum,
+                                           Bytecode_EqualBool,
+                                           Bytecode_EqualStr, Bytecode_Equal));
       break;
     case BinaryOp_NotEqual:
-      write_chunk_u8(chunk, Bytecode_NotEqual);
+      write_chunk_u8(chunk,
+                     typed_equality(expr, Bytecode_NotEqualNum,
+                                    Bytecode_NotEqualBool,
+                                    Bytecode_NotEqualStr, Bytecode_NotEqual));
       break;
     case BinaryOp_Less:
       write_chunk_u8(chunk, Bytecode_Less);
@@ -139,6 +176,99 @@ void compile_expr(Chunk *chunk, const Expr *expr) {
   }
 }
 
+static bool is_number_literal(const Expr *expr) {
+  return expr->type == ExprType_Literal &&
+         value_type(expr->literal) == ValueType_Number;
+}
+
+void compile_discarded_expr(Chunk *chunk, const Expr *expr) {
+  // x = x + k / x = x - k, bumped in place
+  if (expr->type == ExprType_SetVar &&
+      expr->set_var.value->type == ExprType_Binary) {
+    const Expr *value = expr->set_var.value;
+    const Expr *lhs = value->binary.lhs, *rhs = value->binary.rhs;
+    if ((value->binary.op == BinaryOp_Add ||
+         value->binary.op == BinaryOp_Subtract) &&
+        lhs->type == ExprType_GetVar &&
+        lhs->get_var.idx == expr->set_var.idx &&
+        expr->set_var.idx <= UINT8_MAX && is_number_literal(rhs)) {
+      double step = value_as_number(rhs->literal);
+      write_chunk_u8(chunk, Bytecode_AddLocalConst);
+      write_chunk_u8(chunk, expr->set_var.idx);
+      write_chunk_f64(chunk,
+                      (value->binary.op == BinaryOp_Add) ? step : -step);
+      return;
+    }
+  }
+
+  compile_expr(chunk, expr);
+  if (!is_type_def_void(expr->return_type))
+    write_chunk_u8(chunk, Bytecode_Pop);
+}
+
+size_t compile_jump_if_false(Chunk *chunk, const Expr *cond) {
+  if (cond->type == ExprType_Binary) {
+    const Expr *lhs = cond->binary.lhs, *rhs = cond->binary.rhs;
+
+    Bytecode jump, local_const_jump;
+    switch (cond->binary.op) {
+    case BinaryOp_Equal:
+      jump = typed_equality(cond, Bytecode_JumpIfNotEqualNum,
+                            Bytecode_JumpIfNotEqualBool,
+                            Bytecode_JumpIfNotEqualStr,
+                            Bytecode_JumpIfNotEqual);
+      local_const_jump = jump;
+      break;
+    case BinaryOp_NotEqual:
+      jump = typed_equality(cond, Bytecode_JumpIfEqualNum,
+                            Bytecode_JumpIfEqualBool, Bytecode_JumpIfEqualStr,
+                            Bytecode_JumpIfEqual);
+      local_const_jump = jump;
+      break;
+    case BinaryOp_Less:
+      jump = Bytecode_JumpIfNotLess;
+      local_const_jump = Bytecode_JumpIfNotLessLocalConst;
+      break;
+    case BinaryOp_LessEqual:
+      jump = Bytecode_JumpIfNotLessEqual;
+      local_const_jump = Bytecode_JumpIfNotLessEqualLocalConst;
+      break;
+    case BinaryOp_Greater:
+      jump = Bytecode_JumpIfNotGreater;
+      local_const_jump = Bytecode_JumpIfNotGreaterLocalConst;
+      break;
+    case BinaryOp_GreaterEqual:
+      jump = Bytecode_JumpIfNotGreaterEqual;
+      local_const_jump = Bytecode_JumpIfNotGreaterEqualLocalConst;
+      break;
+    default:
+      jump = Bytecode_JumpIfFalse;
+      local_const_jump = Bytecode_JumpIfFalse;
+      break;
+    }
+
+    // comparing a variable against a constant doesn't need the stack at all
+    if (local_const_jump != jump && lhs->type == ExprType_GetVar &&
+        lhs->get_var.idx <= UINT8_MAX && is_number_literal(rhs)) {
+      write_chunk_u8(chunk, local_const_jump);
+      write_chunk_u8(chunk, lhs->get_var.idx);
+      write_chunk_f64(chunk, value_as_number(rhs->literal));
+      return write_chunk_hole(chunk, 16);
+    }
+
+    if (jump != Bytecode_JumpIfFalse) {
+      compile_expr(chunk, lhs);
+      compile_expr(chunk, rhs);
+      write_chunk_u8(chunk, jump);
+      return write_chunk_hole(chunk, 16);
+    }
+  }
+
+  compile_expr(chunk, cond);
+  write_chunk_u8(chunk, Bytecode_JumpIfFalse);
+  return write_chunk_hole(chunk, 16);
+}
+
 void disassemble_chunk(const Chunk *chunk, const Registry *registry) {
   size_t pos = 0;
   while (pos < chunk->size) {
@@ -161,7 +291,8 @@ void disassemble_chunk(const Chunk *chunk, const Registry *registry) {
     case Bytecode_PushString: {
       uint16_t idx = read_chunk_u16(chunk, &pos);
       assert(idx < chunk->strings_num);
-      printf("push_string \"%s\"\n", chunk->strings[idx].chars);
+      printf("push_string \"%s\"\n",
+             value_as_c_string(chunk->strings[idx]));
       break;
     }
     case Bytecode_Copy:
@@ -170,6 +301,9 @@ void disassemble_chunk(const Chunk *chunk, const Registry *registry) {
     case Bytecode_Pop:
       printf("pop\n");
       break;
+    case Bytecode_PopN:
+      printf("pop_n %d\n", read_chunk_u8(chunk, &pos));
+      break;
 
     case Bytecode_Load:
       printf("load $%d\n", read_chunk_u8(chunk, &pos));
@@ -177,6 +311,15 @@ void disassemble_chunk(const Chunk *chunk, const Registry *registry) {
     case Bytecode_Store:
       printf("store $%d\n", read_chunk_u8(chunk, &pos));
       break;
+    case Bytecode_LoadWide:
+      printf("load_wide $%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_StoreWide:
+      printf("store_wide $%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_StorePop:
+      printf("store_pop $%d\n", read_chunk_u8(chunk, &pos));
+      break;
 
     case Bytecode_NativeCall: {
       uint16_t idx = read_chunk_u16(chunk, &pos);
@@ -225,6 +368,24 @@ void disassemble_chunk(const Chunk *chunk, const Registry *registry) {
     case Bytecode_GreaterEqual:
       printf("greater_equal\n");
       break;
+    case Bytecode_EqualNum:
+      printf("equal_num\n");
+      break;
+    case Bytecode_NotEqualNum:
+      printf("not_equal_num\n");
+      break;
+    case Bytecode_EqualBool:
+      printf("equal_bool\n");
+      break;
+    case Bytecode_NotEqualBool:
+      printf("not_equal_bool\n");
+      break;
+    case Bytecode_EqualStr:
+      printf("equal_str\n");
+      break;
+    case Bytecode_NotEqualStr:
+      printf("not_equal_str\n");
+      break;
 
     case Bytecode_Concat:
       printf("concat\n");
@@ -248,6 +409,1256 @@ void disassemble_chunk(const Chunk *chunk, const Registry *registry) {
     case Bytecode_JumpIfTrueRetain:
       printf("jump_if_true_retain +%d\n", read_chunk_u16(chunk, &pos));
       break;
+    case Bytecode_JumpLong:
+      printf("jump_long +%u\n", read_chunk_u32(chunk, &pos));
+      break;
+    case Bytecode_JumpBackLong:
+      printf("jump_back_long -%u\n", read_chunk_u32(chunk, &pos));
+      break;
+
+    case Bytecode_AddLocalConst: {
+      uint8_t idx = read_chunk_u8(chunk, &pos);
+      printf("add_local_const $%d %f\n", idx, read_chunk_f64(chunk, &pos));
+      break;
+    }
+    case Bytecode_IncLocalAndLoop: {
+      uint8_t idx = read_chunk_u8(chunk, &pos);
+      double step = read_chunk_f64(chunk, &pos);
+      printf("inc_local_and_loop $%d %f -%d\n", idx, step,
+             read_chunk_u16(chunk, &pos));
+      break;
+    }
+
+    case Bytecode_JumpIfNotEqual:
+      printf("jump_if_not_equal +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfEqual:
+      printf("jump_if_equal +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotEqualNum:
+      printf("jump_if_not_equal_num +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfEqualNum:
+      printf("jump_if_equal_num +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotEqualBool:
+      printf("jump_if_not_equal_bool +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfEqualBool:
+      printf("jump_if_equal_bool +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotEqualStr:
+      printf("jump_if_not_equal_str +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfEqualStr:
+      printf("jump_if_equal_str +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotLess:
+      printf("jump_if_not_less +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotLessEqual:
+      printf("jump_if_not_less_equal +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotGreater:
+      printf("jump_if_not_greater +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+    case Bytecode_JumpIfNotGreaterEqual:
+      printf("jump_if_not_greater_equal +%d\n", read_chunk_u16(chunk, &pos));
+      break;
+
+#define LOCAL_CONST_JUMP(enum_name, text)                                      \
+  case Bytecode_##enum_name: {                                                 \
+    uint8_t idx = read_chunk_u8(chunk, &pos);                                  \
+    double constant = read_chunk_f64(chunk, &pos);                             \
+    printf(text " $%d %f +%d\n", idx, constant, read_chunk_u16(chunk, &pos));  \
+    break;                                                                     \
+  }
+      LOCAL_CONST_JUMP(JumpIfNotLessLocalConst, "jump_if_not_less_local_const")
+      LOCAL_CONST_JUMP(JumpIfNotLessEqualLocalConst,
+                       "jump_if_not_less_equal_local_const")
+      LOCAL_CONST_JUMP(JumpIfNotGreaterLocalConst,
+                       "jump_if_not_greater_local_const")
+      LOCAL_CONST_JUMP(JumpIfNotGreaterEqualLocalConst,
+                       "jump_if_not_greater_equal_local_const")
+#undef LOCAL_CONST_JUMP
+
+    case Bytecode_Return:
+      printf("return\n");
+      break;
+    case Bytecode_Halt:
+      printf("halt\n");
+      break;
+    }
+  }
+}
+
+static bool is_jump(Bytecode instruction) {
+  switch (instruction) {
+  case Bytecode_Jump:
+  case Bytecode_JumpBack:
+  case Bytecode_JumpIfFalse:
+  case Bytecode_JumpIfTrue:
+  case Bytecode_JumpIfFalseRetain:
+  case Bytecode_JumpIfTrueRetain:
+  case Bytecode_JumpLong:
+  case Bytecode_JumpBackLong:
+  case Bytecode_IncLocalAndLoop:
+  case Bytecode_JumpIfNotEqual:
+  case Bytecode_JumpIfEqual:
+  case Bytecode_JumpIfNotEqualNum:
+  case Bytecode_JumpIfEqualNum:
+  case Bytecode_JumpIfNotEqualBool:
+  case Bytecode_JumpIfEqualBool:
+  case Bytecode_JumpIfNotEqualStr:
+  case Bytecode_JumpIfEqualStr:
+  case Bytecode_JumpIfNotLess:
+  case Bytecode_JumpIfNotLessEqual:
+  case Bytecode_JumpIfNotGreater:
+  case Bytecode_JumpIfNotGreaterEqual:
+  case Bytecode_JumpIfNotLessLocalConst:
+  case Bytecode_JumpIfNotLessEqualLocalConst:
+  case Bytecode_JumpIfNotGreaterLocalConst:
+  case Bytecode_JumpIfNotGreaterEqualLocalConst:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool is_backward_jump(Bytecode instruction) {
+  return instruction == Bytecode_JumpBack ||
+         instruction == Bytecode_JumpBackLong ||
+         instruction == Bytecode_IncLocalAndLoop;
+}
+
+// the offset is always a jump's last operand, relative to its end
+static size_t jump_offset_size(Bytecode instruction) {
+  if (instruction == Bytecode_JumpLong || instruction == Bytecode_JumpBackLong)
+    return sizeof(uint32_t);
+  return sizeof(uint16_t);
+}
+
+static size_t read_jump_target(const Chunk *chunk, size_t pos) {
+  Bytecode op = chunk->code[pos];
+  size_t end = pos + bytecode_size(op);
+  size_t offset_pos = end - jump_offset_size(op);
+  size_t offset = (jump_offset_size(op) == sizeof(uint32_t))
+                      ? read_chunk_u32(chunk, &offset_pos)
+                      : read_chunk_u16(chunk, &offset_pos);
+  return is_backward_jump(op) ? end - offset : end + offset;
+}
+
+static bool is_plain_jump(Bytecode op) {
+  return op == Bytecode_Jump || op == Bytecode_JumpBack ||
+         op == Bytecode_JumpLong || op == Bytecode_JumpBackLong;
+}
+
+size_t bytecode_size(Bytecode op) {
+  switch (op) {
+  case Bytecode_PushNull:
+  case Bytecode_PushTrue:
+  case Bytecode_PushFalse:
+  case Bytecode_Copy:
+  case Bytecode_Pop:
+  case Bytecode_Negate:
+  case Bytecode_Not:
+  case Bytecode_Add:
+  case Bytecode_Subtract:
+  case Bytecode_Multiply:
+  case Bytecode_Divide:
+  case Bytecode_Equal:
+  case Bytecode_NotEqual:
+  case Bytecode_Less:
+  case Bytecode_LessEqual:
+  case Bytecode_Greater:
+  case Bytecode_GreaterEqual:
+  case Bytecode_EqualNum:
+  case Bytecode_NotEqualNum:
+  case Bytecode_EqualBool:
+  case Bytecode_NotEqualBool:
+  case Bytecode_EqualStr:
+  case Bytecode_NotEqualStr:
+  case Bytecode_Concat:
+  case Bytecode_Return:
+    return 1;
+  case Bytecode_PushNumber:
+    return 1 + sizeof(double);
+  case Bytecode_PushString:
+    return 1 + sizeof(uint16_t);
+  case Bytecode_PopN:
+  case Bytecode_Load:
+  case Bytecode_Store:
+  case Bytecode_StorePop:
+    return 1 + sizeof(uint8_t);
+  case Bytecode_LoadWide:
+  case Bytecode_StoreWide:
+    return 1 + sizeof(uint16_t);
+  case Bytecode_NativeCall:
+    return 1 + sizeof(uint16_t) + sizeof(uint8_t);
+
+  case Bytecode_Jump:
+  case Bytecode_JumpBack:
+  case Bytecode_JumpIfFalse:
+  case Bytecode_JumpIfTrue:
+  case Bytecode_JumpIfFalseRetain:
+  case Bytecode_JumpIfTrueRetain:
+  case Bytecode_JumpIfNotEqual:
+  case Bytecode_JumpIfEqual:
+  case Bytecode_JumpIfNotEqualNum:
+  case Bytecode_JumpIfEqualNum:
+  case Bytecode_JumpIfNotEqualBool:
+  case Bytecode_JumpIfEqualBool:
+  case Bytecode_JumpIfNotEqualStr:
+  case Bytecode_JumpIfEqualStr:
+  case Bytecode_JumpIfNotLess:
+  case Bytecode_JumpIfNotLessEqual:
+  case Bytecode_JumpIfNotGreater:
+  case Bytecode_JumpIfNotGreaterEqual:
+    return 1 + sizeof(uint16_t);
+  case Bytecode_JumpLong:
+  case Bytecode_JumpBackLong:
+    return 1 + sizeof(uint32_t);
+
+  case Bytecode_AddLocalConst:
+    return 1 + sizeof(uint8_t) + sizeof(double);
+  case Bytecode_IncLocalAndLoop:
+  case Bytecode_JumpIfNotLessLocalConst:
+  case Bytecode_JumpIfNotLessEqualLocalConst:
+  case Bytecode_JumpIfNotGreaterLocalConst:
+  case Bytecode_JumpIfNotGreaterEqualLocalConst:
+    return 1 + sizeof(uint8_t) + sizeof(double) + sizeof(uint16_t);
+
+  default:
+    return 0;
+  }
+}
+
+// what the check knows about a value on the stack: its type and whether it
+// might be null instead, or ValueType_Error once paths that disagree meet
+static const TypeDef unknown_type = {ValueType_Error};
+
+static TypeDef join_types(TypeDef lhs, TypeDef rhs) {
+  if (lhs.value == ValueType_Error || rhs.value == ValueType_Error)
+    return unknown_type;
+  if (lhs.value == rhs.value)
+    return new_type_def(lhs.value, lhs.optional || rhs.optional);
+  if (lhs.value == ValueType_Null)
+    return new_type_def(rhs.value, true);
+  if (rhs.value == ValueType_Null)
+    return new_type_def(lhs.value, true);
+  return unknown_type;
+}
+
+// the vms read typed operands without looking at their tags, so these have
+// to be exactly the type and never null
+static bool is_proven_type(TypeDef type, ValueType value) {
+  return type.value == value && !type.optional;
+}
+
+// whether a value of type have can be passed where want is declared
+static bool accepts_type(TypeDef want, TypeDef have) {
+  if (want.optional && have.value == ValueType_Null)
+    return true;
+  return have.value == want.value && (want.optional || !have.optional);
+}
+
+// walks every path through the code with the type of each value on the
+// stack. paths only meet at jump targets, so those are the only places a
+// state is kept, widened and walked again until it stops changing
+typedef struct StackCheck {
+  const Chunk *chunk;
+  const Registry *registry;
+
+  bool *targets;
+  // the stack on arriving at each target, NULL until something gets there
+  TypeDef **states;
+  size_t *depths;
+  // targets waiting to be walked from
+  bool *queued;
+  size_t *work;
+  size_t work_num;
+
+  // the stack of the path being walked
+  TypeDef *stack;
+  size_t depth, stack_cap;
+} StackCheck;
+
+static bool push_type(StackCheck *check, TypeDef type) {
+  if (check->depth == check->stack_cap) {
+    check->stack_cap = (check->stack_cap == 0) ? 16 : check->stack_cap * 2;
+    check->stack =
+        realloc(check->stack, check->stack_cap * sizeof(*check->stack));
+    assert(check->stack != NULL);
+  }
+  check->stack[check->depth++] = type;
+  return true;
+}
+
+// ValueType_Error takes a value of any type
+static bool pop_type(StackCheck *check, ValueType value) {
+  if (check->depth == 0)
+    return false;
+  TypeDef type = check->stack[--check->depth];
+  return value == ValueType_Error || is_proven_type(type, value);
+}
+
+static bool is_proven_slot(const StackCheck *check, size_t slot,
+                           ValueType value) {
+  return slot < check->depth && is_proven_type(check->stack[slot], value);
+}
+
+static bool check_binary(StackCheck *check, ValueType operands,
+                         TypeDef result) {
+  return pop_type(check, operands) && pop_type(check, operands) &&
+         push_type(check, result);
+}
+
+// joins the stack being walked into the state at pos
+static bool merge_state(StackCheck *check, size_t pos) {
+  // running off the end halts, whatever is left on the stack
+  if (pos == check->chunk->size)
+    return true;
+
+  TypeDef *state = check->states[pos];
+  if (state == NULL) {
+    state = malloc((check->depth + 1) * sizeof(*state));
+    assert(state != NULL);
+    for (size_t i = 0; i < check->depth; i++)
+      state[i] = check->stack[i];
+    check->states[pos] = state;
+    check->depths[pos] = check->depth;
+  } else {
+    if (check->depths[pos] != check->depth)
+      return false;
+
+    bool changed = false;
+    for (size_t i = 0; i < check->depth; i++) {
+      TypeDef joined = join_types(state[i], check->stack[i]);
+      changed = changed || joined.value != state[i].value ||
+                joined.optional != state[i].optional;
+      state[i] = joined;
     }
+    if (!changed)
+      return true;
   }
-}
\ No newline at end of file
+
+  if (!check->queued[pos]) {
+    check->queued[pos] = true;
+    check->work[check->work_num++] = pos;
+  }
+  return true;
+}
+
+static bool check_native_call(StackCheck *check, size_t operand_pos) {
+  const Chunk *chunk = check->chunk;
+  const NativeFn *fn =
+      &check->registry->native_fns[read_chunk_u16(chunk, &operand_pos)];
+  size_t argc = read_chunk_u8(chunk, &operand_pos);
+  if (argc < fn->args_num || (argc > fn->args_num && !fn->variadic) ||
+      argc > check->depth)
+    return false;
+
+  // whatever goes into the variadic part is fine
+  const TypeDef *argv = check->stack + check->depth - argc;
+  for (size_t i = 0; i < fn->args_num; i++) {
+    if (!accepts_type(fn->arg_types[i], argv[i]))
+      return false;
+  }
+  check->depth -= argc;
+  return is_type_def_void(fn->return_type) ||
+         push_type(check, fn->return_type);
+}
+
+// applies a single instruction to the stack, jumps also merge into their
+// target
+static bool check_instruction(StackCheck *check, size_t pos) {
+  const Chunk *chunk = check->chunk;
+  Bytecode op = chunk->code[pos];
+  size_t operand_pos = pos + 1;
+  size_t target = is_jump(op) ? read_jump_target(chunk, pos) : 0;
+
+  switch (op) {
+  case Bytecode_PushNull:
+    return push_type(check, TypeDef_Null);
+  case Bytecode_PushNumber:
+    return push_type(check, TypeDef_Number);
+  case Bytecode_PushTrue:
+  case Bytecode_PushFalse:
+    return push_type(check, TypeDef_Boolean);
+  case Bytecode_PushString:
+    return push_type(check, TypeDef_String);
+  case Bytecode_Copy:
+    return check->depth != 0 &&
+           push_type(check, check->stack[check->depth - 1]);
+  case Bytecode_Pop:
+    return pop_type(check, ValueType_Error);
+  case Bytecode_PopN: {
+    size_t count = read_chunk_u8(chunk, &operand_pos);
+    if (count > check->depth)
+      return false;
+    check->depth -= count;
+    return true;
+  }
+
+  case Bytecode_Load:
+  case Bytecode_LoadWide: {
+    size_t slot = (op == Bytecode_Load) ? read_chunk_u8(chunk, &operand_pos)
+                                        : read_chunk_u16(chunk, &operand_pos);
+    return slot < check->depth && push_type(check, check->stack[slot]);
+  }
+  case Bytecode_Store:
+  case Bytecode_StoreWide: {
+    size_t slot = (op == Bytecode_Store) ? read_chunk_u8(chunk, &operand_pos)
+                                         : read_chunk_u16(chunk, &operand_pos);
+    if (slot >= check->depth)
+      return false;
+    check->stack[slot] = check->stack[check->depth - 1];
+    return true;
+  }
+  case Bytecode_StorePop: {
+    size_t slot = read_chunk_u8(chunk, &operand_pos);
+    if (check->depth == 0 || slot >= check->depth - 1)
+      return false;
+    check->stack[slot] = check->stack[--check->depth];
+    return true;
+  }
+
+  case Bytecode_NativeCall:
+    return check_native_call(check, operand_pos);
+
+  case Bytecode_Negate:
+    return pop_type(check, ValueType_Number) &&
+           push_type(check, TypeDef_Number);
+  case Bytecode_Not:
+    return pop_type(check, ValueType_Boolean) &&
+           push_type(check, TypeDef_Boolean);
+
+  case Bytecode_Add:
+  case Bytecode_Subtract:
+  case Bytecode_Multiply:
+  case Bytecode_Divide:
+    return check_binary(check, ValueType_Number, TypeDef_Number);
+  case Bytecode_Less:
+  case Bytecode_LessEqual:
+  case Bytecode_Greater:
+  case Bytecode_GreaterEqual:
+  case Bytecode_EqualNum:
+  case Bytecode_NotEqualNum:
+    return check_binary(check, ValueType_Number, TypeDef_Boolean);
+  case Bytecode_Equal:
+  case Bytecode_NotEqual:
+    return check_binary(check, ValueType_Error, TypeDef_Boolean);
+  case Bytecode_EqualBool:
+  case Bytecode_NotEqualBool:
+    return check_binary(check, ValueType_Boolean, TypeDef_Boolean);
+  case Bytecode_EqualStr:
+  case Bytecode_NotEqualStr:
+    return check_binary(check, ValueType_String, TypeDef_Boolean);
+  case Bytecode_Concat:
+    return check_binary(check, ValueType_String, TypeDef_String);
+
+  case Bytecode_Jump:
+  case Bytecode_JumpBack:
+  case Bytecode_JumpLong:
+  case Bytecode_JumpBackLong:
+    return merge_state(check, target);
+  case Bytecode_JumpIfFalse:
+  case Bytecode_JumpIfTrue:
+    return pop_type(check, ValueType_Boolean) && merge_state(check, target);
+  // the condition is still there when they jump
+  case Bytecode_JumpIfFalseRetain:
+  case Bytecode_JumpIfTrueRetain:
+    return check->depth != 0 &&
+           is_proven_type(check->stack[check->depth - 1],
+                          ValueType_Boolean) &&
+           merge_state(check, target) && pop_type(check, ValueType_Boolean);
+
+  case Bytecode_AddLocalConst:
+    return is_proven_slot(check, read_chunk_u8(chunk, &operand_pos),
+                          ValueType_Number);
+  case Bytecode_IncLocalAndLoop:
+  case Bytecode_JumpIfNotLessLocalConst:
+  case Bytecode_JumpIfNotLessEqualLocalConst:
+  case Bytecode_JumpIfNotGreaterLocalConst:
+  case Bytecode_JumpIfNotGreaterEqualLocalConst:
+    return is_proven_slot(check, read_chunk_u8(chunk, &operand_pos),
+                          ValueType_Number) &&
+           merge_state(check, target);
+
+  case Bytecode_JumpIfNotEqual:
+  case Bytecode_JumpIfEqual:
+    return pop_type(check, ValueType_Error) &&
+           pop_type(check, ValueType_Error) && merge_state(check, target);
+  case Bytecode_JumpIfNotEqualNum:
+  case Bytecode_JumpIfEqualNum:
+  case Bytecode_JumpIfNotLess:
+  case Bytecode_JumpIfNotLessEqual:
+  case Bytecode_JumpIfNotGreater:
+  case Bytecode_JumpIfNotGreaterEqual:
+    return pop_type(check, ValueType_Number) &&
+           pop_type(check, ValueType_Number) && merge_state(check, target);
+  case Bytecode_JumpIfNotEqualBool:
+  case Bytecode_JumpIfEqualBool:
+    return pop_type(check, ValueType_Boolean) &&
+           pop_type(check, ValueType_Boolean) && merge_state(check, target);
+  case Bytecode_JumpIfNotEqualStr:
+  case Bytecode_JumpIfEqualStr:
+    return pop_type(check, ValueType_String) &&
+           pop_type(check, ValueType_String) && merge_state(check, target);
+
+  case Bytecode_Return:
+    return pop_type(check, ValueType_Error);
+
+  default:
+    return false;
+  }
+}
+
+static bool falls_through(Bytecode op) {
+  return !is_plain_jump(op) && op != Bytecode_IncLocalAndLoop &&
+         op != Bytecode_Return;
+}
+
+// walks from a target up to wherever the path next meets another one
+static bool walk_from(StackCheck *check, size_t pos) {
+  check->depth = 0;
+  for (size_t i = 0; i < check->depths[pos]; i++)
+    push_type(check, check->states[pos][i]);
+
+  for (;;) {
+    Bytecode op = check->chunk->code[pos];
+    if (!check_instruction(check, pos))
+      return false;
+    if (!falls_through(op))
+      return true;
+
+    pos += bytecode_size(op);
+    if (check->targets[pos])
+      return merge_state(check, pos);
+  }
+}
+
+// nothing pops more than is there, touches a slot past the top, or hands an
+// instruction that reads its operands without checking their tags a value
+// that isn't proven to be the right type on every path
+static bool verify_stack(const Chunk *chunk, const Registry *registry) {
+  if (chunk->size == 0)
+    return true;
+
+  // every position gets on the work list at most once at a time
+  StackCheck check = {
+      .chunk = chunk,
+      .registry = registry,
+
+      .targets = calloc(chunk->size + 1, sizeof(*check.targets)),
+      .states = calloc(chunk->size, sizeof(*check.states)),
+      .depths = malloc(chunk->size * sizeof(*check.depths)),
+      .queued = calloc(chunk->size, sizeof(*check.queued)),
+      .work = malloc(chunk->size * sizeof(*check.work)),
+      .work_num = 0,
+
+      .stack = NULL,
+      .depth = 0,
+      .stack_cap = 0,
+  };
+  assert(check.targets != NULL && check.states != NULL &&
+         check.depths != NULL && check.queued != NULL && check.work != NULL);
+
+  // the start and the end count as targets too, so every walk stops at one
+  check.targets[0] = true;
+  check.targets[chunk->size] = true;
+  for (size_t pos = 0; pos < chunk->size;
+       pos += bytecode_size(chunk->code[pos])) {
+    if (is_jump(chunk->code[pos]))
+      check.targets[read_jump_target(chunk, pos)] = true;
+  }
+
+  // arguments are already on the stack when the code starts
+  for (size_t i = 0; i < chunk->args_num; i++)
+    push_type(&check, chunk->arg_types[i]);
+  bool ok = merge_state(&check, 0);
+  while (ok && check.work_num != 0) {
+    size_t pos = check.work[--check.work_num];
+    check.queued[pos] = false;
+    ok = walk_from(&check, pos);
+  }
+
+  for (size_t i = 0; i < chunk->size; i++)
+    free(check.states[i]);
+  free(check.stack);
+  free(check.work);
+  free(check.queued);
+  free(check.depths);
+  free(check.states);
+  free(check.targets);
+  return ok;
+}
+
+bool verify_chunk(const Chunk *chunk, const Registry *registry) {
+  // which byte offsets an instruction starts at
+  bool *starts = calloc(chunk->size + 1, sizeof(*starts));
+  assert(starts != NULL);
+
+  bool ok = true;
+  for (size_t pos = 0; ok && pos < chunk->size;) {
+    size_t size = bytecode_size(chunk->code[pos]);
+    if (size == 0 || size > chunk->size - pos) {
+      ok = false;
+      break;
+    }
+    starts[pos] = true;
+    pos += size;
+  }
+  // landing right at the end halts
+  starts[chunk->size] = true;
+
+  for (size_t pos = 0; ok && pos < chunk->size;) {
+    Bytecode op = chunk->code[pos];
+    size_t end = pos + bytecode_size(op);
+    size_t operand_pos = pos + 1;
+
+    if (op == Bytecode_PushString) {
+      ok = read_chunk_u16(chunk, &operand_pos) < chunk->strings_num;
+    } else if (op == Bytecode_NativeCall) {
+      ok = read_chunk_u16(chunk, &operand_pos) < registry->native_fns_num;
+    } else if (is_jump(op)) {
+      size_t offset_pos = end - jump_offset_size(op);
+      size_t offset = (jump_offset_size(op) == sizeof(uint32_t))
+                          ? read_chunk_u32(chunk, &offset_pos)
+                          : read_chunk_u16(chunk, &offset_pos);
+      if (is_backward_jump(op))
+        ok = offset <= end && starts[end - offset];
+      else
+        ok = offset <= chunk->size - end && starts[end + offset];
+    }
+    pos = end;
+  }
+
+  free(starts);
+  // only once every operand is known to be in range
+  return ok && verify_stack(chunk, registry);
+}
+
+// what a jump becomes once it's too far for a u16 offset. plain jumps get the
+// long form, IncLocalAndLoop splits into its add and a long jump back, and
+// conditional jumps (all forward) hop onto an island right after them:
+//   jump_if_* +3, jump +5, jump_long target
+static size_t far_jump_size(Bytecode op) {
+  switch (op) {
+  case Bytecode_Jump:
+    return bytecode_size(Bytecode_JumpLong);
+  case Bytecode_JumpBack:
+    return bytecode_size(Bytecode_JumpBackLong);
+  case Bytecode_IncLocalAndLoop:
+    return bytecode_size(Bytecode_AddLocalConst) +
+           bytecode_size(Bytecode_JumpBackLong);
+  default:
+    assert(!is_backward_jump(op));
+    return bytecode_size(op) + bytecode_size(Bytecode_Jump) +
+           bytecode_size(Bytecode_JumpLong);
+  }
+}
+
+typedef struct RelaxOp {
+  size_t pos;    // in the original code
+  size_t target; // original byte offset a jump lands on
+  bool far;
+} RelaxOp;
+
+static int compare_far_jumps(const void *lhs, const void *rhs) {
+  size_t lhs_hole = ((const ChunkFarJump *)lhs)->hole;
+  size_t rhs_hole = ((const ChunkFarJump *)rhs)->hole;
+  return (lhs_hole > rhs_hole) - (lhs_hole < rhs_hole);
+}
+
+static void copy_code(Chunk *out, const Chunk *chunk, size_t pos, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    write_chunk_u8(out, chunk->code[pos + i]);
+}
+
+void relax_chunk(Chunk *chunk) {
+  if (chunk->far_jumps_num == 0)
+    return;
+  qsort(chunk->far_jumps, chunk->far_jumps_num, sizeof(*chunk->far_jumps),
+        compare_far_jumps);
+
+  // a chunk never holds more instructions than bytes
+  RelaxOp *ops = malloc((chunk->size + 1) * sizeof(*ops));
+  size_t *index_at = malloc((chunk->size + 1) * sizeof(*index_at));
+  assert(ops != NULL && index_at != NULL);
+
+  size_t ops_num = 0, far_idx = 0;
+  for (size_t pos = 0; pos < chunk->size;) {
+    Bytecode op = chunk->code[pos];
+    size_t end = pos + bytecode_size(op);
+    RelaxOp *relax_op = &ops[ops_num];
+    *relax_op = (RelaxOp){
+        .pos = pos,
+        .target = 0,
+        .far = false,
+    };
+    index_at[pos] = ops_num++;
+
+    if (is_jump(op)) {
+      size_t hole = end - sizeof(uint16_t);
+      if (far_idx < chunk->far_jumps_num &&
+          chunk->far_jumps[far_idx].hole == hole) {
+        relax_op->target = chunk->far_jumps[far_idx++].target;
+        relax_op->far = true;
+      } else {
+        uint16_t offset = read_chunk_u16(chunk, &hole);
+        relax_op->target = is_backward_jump(op) ? end - offset : end + offset;
+      }
+    }
+    pos = end;
+  }
+  assert(far_idx == chunk->far_jumps_num);
+  index_at[chunk->size] = ops_num;
+
+  // widening one jump can push others out of range, so lay the code out
+  // again until nothing else has to grow
+  size_t *new_pos = malloc((ops_num + 1) * sizeof(*new_pos));
+  assert(new_pos != NULL);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    size_t pos = 0;
+    for (size_t i = 0; i < ops_num; i++) {
+      Bytecode op = chunk->code[ops[i].pos];
+      new_pos[i] = pos;
+      pos += ops[i].far ? far_jump_size(op) : bytecode_size(op);
+    }
+    new_pos[ops_num] = pos;
+
+    for (size_t i = 0; i < ops_num; i++) {
+      Bytecode op = chunk->code[ops[i].pos];
+      if (!is_jump(op) || ops[i].far)
+        continue;
+
+      size_t end = new_pos[i] + bytecode_size(op);
+      size_t target = new_pos[index_at[ops[i].target]];
+      size_t offset = is_backward_jump(op) ? end - target : target - end;
+      if (offset > UINT16_MAX) {
+        ops[i].far = true;
+        changed = true;
+      }
+    }
+  }
+
+  Chunk out = new_chunk();
+  for (size_t i = 0; i < ops_num; i++) {
+    assert(out.size == new_pos[i]);
+    size_t pos = ops[i].pos;
+    Bytecode op = chunk->code[pos];
+    size_t size = bytecode_size(op);
+    if (!is_jump(op)) {
+      copy_code(&out, chunk, pos, size);
+      continue;
+    }
+
+    size_t target = new_pos[index_at[ops[i].target]];
+    if (!ops[i].far) {
+      copy_code(&out, chunk, pos, size - sizeof(uint16_t));
+      size_t end = out.size + sizeof(uint16_t);
+      write_chunk_u16(&out,
+                      is_backward_jump(op) ? end - target : target - end);
+      continue;
+    }
+
+    switch (op) {
+    case Bytecode_Jump:
+      write_chunk_u8(&out, Bytecode_JumpLong);
+      write_chunk_u32(&out, target - (out.size + sizeof(uint32_t)));
+      break;
+    case Bytecode_JumpBack:
+      write_chunk_u8(&out, Bytecode_JumpBackLong);
+      write_chunk_u32(&out, out.size + sizeof(uint32_t) - target);
+      break;
+    case Bytecode_IncLocalAndLoop:
+      // same slot and step, the add just doesn't jump
+      write_chunk_u8(&out, Bytecode_AddLocalConst);
+      copy_code(&out, chunk, pos + 1, sizeof(uint8_t) + sizeof(double));
+      write_chunk_u8(&out, Bytecode_JumpBackLong);
+      write_chunk_u32(&out, out.size + sizeof(uint32_t) - target);
+      break;
+    default:
+      copy_code(&out, chunk, pos, size - sizeof(uint16_t));
+      write_chunk_u16(&out, bytecode_size(Bytecode_Jump));
+      write_chunk_u8(&out, Bytecode_Jump);
+      write_chunk_u16(&out, bytecode_size(Bytecode_JumpLong));
+      write_chunk_u8(&out, Bytecode_JumpLong);
+      write_chunk_u32(&out, target - (out.size + sizeof(uint32_t)));
+      break;
+    }
+  }
+  assert(out.size == new_pos[ops_num]);
+
+  free(chunk->code);
+  chunk->code = out.code;
+  chunk->size = out.size;
+  chunk->cap = out.cap;
+  chunk->far_jumps_num = 0;
+
+  free(new_pos);
+  free(index_at);
+  free(ops);
+}
+
+// an op the peephole pass is going to write, copied from the old code or
+// standing in for several of its ops
+typedef struct PeepholeOp {
+  Bytecode op;
+  size_t pos;  // in the old code, where anything that isn't a pop is read from
+  uint8_t arg; // the count of a PopN or the slot of a StorePop
+  // something jumps here, so it can't be merged into what comes before
+  bool target;
+  // old byte offsets a jump lands on, as written and after following any
+  // plain jumps it lands on
+  size_t jump_target, final_target;
+} PeepholeOp;
+
+typedef struct Peephole {
+  const Chunk *chunk;
+  PeepholeOp *ops;
+  size_t ops_num;
+  // an op that was a jump target got merged away, whatever comes next takes
+  // its place
+  bool pending_target;
+} Peephole;
+
+// where a jump to target ends up once it stops landing on plain jumps, the
+// hop limit keeps a loop of jumps from hanging the compiler
+static size_t follow_jumps(const Chunk *chunk, size_t target) {
+  for (size_t hops = 0; hops < 8; hops++) {
+    if (target >= chunk->size || !is_plain_jump(chunk->code[target]))
+      break;
+    target = read_jump_target(chunk, target);
+  }
+  return target;
+}
+
+// how many values an op takes when all it does is push a value made from
+// them, -1 for anything else
+static int pure_op_inputs(Bytecode op) {
+  switch (op) {
+  case Bytecode_PushNull:
+  case Bytecode_PushNumber:
+  case Bytecode_PushTrue:
+  case Bytecode_PushFalse:
+  case Bytecode_PushString:
+  case Bytecode_Copy:
+  case Bytecode_Load:
+  case Bytecode_LoadWide:
+    return 0;
+  case Bytecode_Negate:
+  case Bytecode_Not:
+    return 1;
+  case Bytecode_Add:
+  case Bytecode_Subtract:
+  case Bytecode_Multiply:
+  case Bytecode_Divide:
+  case Bytecode_Equal:
+  case Bytecode_NotEqual:
+  case Bytecode_Less:
+  case Bytecode_LessEqual:
+  case Bytecode_Greater:
+  case Bytecode_GreaterEqual:
+  case Bytecode_EqualNum:
+  case Bytecode_NotEqualNum:
+  case Bytecode_EqualBool:
+  case Bytecode_NotEqualBool:
+  case Bytecode_EqualStr:
+  case Bytecode_NotEqualStr:
+  case Bytecode_Concat:
+    return 2;
+  default:
+    return -1;
+  }
+}
+
+static void add_peephole_op(Peephole *peephole, PeepholeOp op) {
+  op.target = op.target || peephole->pending_target;
+  peephole->pending_target = false;
+  peephole->ops[peephole->ops_num++] = op;
+}
+
+static void add_peephole_pops(Peephole *peephole, size_t pos, size_t count,
+                              bool target) {
+  target = target || peephole->pending_target;
+  peephole->pending_target = false;
+
+  // popping what a pure op pushed undoes it, as long as nothing jumps in
+  // between
+  while (count != 0 && !target && peephole->ops_num != 0) {
+    const PeepholeOp *last = &peephole->ops[peephole->ops_num - 1];
+    int inputs = pure_op_inputs(last->op);
+    if (inputs < 0)
+      break;
+    count += inputs - 1;
+    target = last->target;
+    peephole->ops_num--;
+  }
+  if (count == 0) {
+    peephole->pending_target = target;
+    return;
+  }
+
+  PeepholeOp *last =
+      (peephole->ops_num != 0) ? &peephole->ops[peephole->ops_num - 1] : NULL;
+  if (!target && last != NULL && last->op == Bytecode_Store) {
+    last->op = Bytecode_StorePop;
+    last->arg = peephole->chunk->code[last->pos + 1];
+    count--;
+  } else if (!target && last != NULL &&
+             (last->op == Bytecode_Pop || last->op == Bytecode_PopN)) {
+    size_t popped = (last->op == Bytecode_Pop) ? 1 : last->arg;
+    if (popped + count <= UINT8_MAX) {
+      last->op = Bytecode_PopN;
+      last->arg = popped + count;
+      count = 0;
+    }
+  }
+
+  while (count != 0) {
+    size_t popped = (count < UINT8_MAX) ? count : UINT8_MAX;
+    add_peephole_op(peephole, (PeepholeOp){
+                                  .op = (popped == 1) ? Bytecode_Pop
+                                                      : Bytecode_PopN,
+                                  .pos = pos,
+                                  .arg = popped,
+                                  .target = target,
+                              });
+    target = false;
+    count -= popped;
+  }
+}
+
+// points a jump at target from end if its form allows it, plain jumps can
+// switch direction
+static bool retarget_jump(Bytecode *op, size_t end, size_t target) {
+  bool backward = target < end;
+  if (backward != is_backward_jump(*op)) {
+    switch (*op) {
+    case Bytecode_Jump:
+      *op = Bytecode_JumpBack;
+      break;
+    case Bytecode_JumpBack:
+      *op = Bytecode_Jump;
+      break;
+    case Bytecode_JumpLong:
+      *op = Bytecode_JumpBackLong;
+      break;
+    case Bytecode_JumpBackLong:
+      *op = Bytecode_JumpLong;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  size_t offset = backward ? end - target : target - end;
+  return jump_offset_size(*op) == sizeof(uint32_t) || offset <= UINT16_MAX;
+}
+
+// one go over the code, returns how many instructions it took out
+static size_t peephole_round(Chunk *chunk) {
+  // a chunk never holds more instructions than bytes
+  bool *targets = calloc(chunk->size + 1, sizeof(*targets));
+  size_t *index_at = malloc((chunk->size + 1) * sizeof(*index_at));
+  Peephole peephole = {
+      .chunk = chunk,
+      .ops = malloc((chunk->size + 1) * sizeof(*peephole.ops)),
+      .ops_num = 0,
+      .pending_target = false,
+  };
+  assert(targets != NULL && index_at != NULL && peephole.ops != NULL);
+
+  for (size_t pos = 0; pos < chunk->size;
+       pos += bytecode_size(chunk->code[pos])) {
+    if (is_jump(chunk->code[pos]))
+      targets[read_jump_target(chunk, pos)] = true;
+  }
+
+  size_t old_num = 0;
+  for (size_t pos = 0; pos < chunk->size;) {
+    Bytecode op = chunk->code[pos];
+    size_t end = pos + bytecode_size(op);
+    index_at[pos] = peephole.ops_num;
+    old_num++;
+
+    PeepholeOp peephole_op = {
+        .op = op,
+        .pos = pos,
+        .arg = 0,
+        .target = targets[pos],
+    };
+    if (op == Bytecode_Pop) {
+      add_peephole_pops(&peephole, pos, 1, targets[pos]);
+    } else if (op == Bytecode_PopN) {
+      add_peephole_pops(&peephole, pos, chunk->code[pos + 1], targets[pos]);
+    } else if (op == Bytecode_StorePop) {
+      peephole_op.arg = chunk->code[pos + 1];
+      add_peephole_op(&peephole, peephole_op);
+    } else if (is_jump(op)) {
+      size_t target = read_jump_target(chunk, pos);
+      if (target == end &&
+          (op == Bytecode_Jump || op == Bytecode_JumpLong)) {
+        // going nowhere
+        peephole.pending_target = peephole.pending_target || targets[pos];
+      } else if (target == end &&
+                 (op == Bytecode_JumpIfFalse || op == Bytecode_JumpIfTrue)) {
+        // only the condition is left to get rid of
+        add_peephole_pops(&peephole, pos, 1, targets[pos]);
+      } else {
+        peephole_op.jump_target = target;
+        peephole_op.final_target = follow_jumps(chunk, target);
+        add_peephole_op(&peephole, peephole_op);
+      }
+    } else {
+      add_peephole_op(&peephole, peephole_op);
+    }
+    pos = end;
+  }
+  index_at[chunk->size] = peephole.ops_num;
+
+  size_t *new_pos = malloc((peephole.ops_num + 1) * sizeof(*new_pos));
+  assert(new_pos != NULL);
+  size_t layout_pos = 0;
+  for (size_t i = 0; i < peephole.ops_num; i++) {
+    new_pos[i] = layout_pos;
+    layout_pos += bytecode_size(peephole.ops[i].op);
+  }
+  new_pos[peephole.ops_num] = layout_pos;
+
+  Chunk out = new_chunk();
+  for (size_t i = 0; i < peephole.ops_num; i++) {
+    const PeepholeOp *op = &peephole.ops[i];
+    size_t size = bytecode_size(op->op);
+    switch (op->op) {
+    case Bytecode_Pop:
+      write_chunk_u8(&out, Bytecode_Pop);
+      break;
+    case Bytecode_PopN:
+    case Bytecode_StorePop:
+      write_chunk_u8(&out, op->op);
+      write_chunk_u8(&out, op->arg);
+      break;
+    default:
+      if (!is_jump(op->op)) {
+        copy_code(&out, chunk, op->pos, size);
+        break;
+      }
+
+      // thread the jump through to where it ends up if the offset still fits,
+      // otherwise it just keeps its old target
+      size_t end = new_pos[i] + size;
+      Bytecode jump = op->op;
+      size_t target = new_pos[index_at[op->final_target]];
+      if (!retarget_jump(&jump, end, target)) {
+        // the code only ever shrinks, so the old target still fits as it was
+        jump = op->op;
+        target = new_pos[index_at[op->jump_target]];
+      }
+
+      size_t offset_size = jump_offset_size(jump);
+      size_t offset = (target < end) ? end - target : target - end;
+      write_chunk_u8(&out, jump);
+      copy_code(&out, chunk, op->pos + 1, size - 1 - offset_size);
+      if (offset_size == sizeof(uint32_t))
+        write_chunk_u32(&out, offset);
+      else
+        write_chunk_u16(&out, offset);
+      break;
+    }
+    assert(out.size == new_pos[i + 1]);
+  }
+
+  size_t removed = old_num - peephole.ops_num;
+  chunk->peephole_bytes += chunk->size - out.size;
+  chunk->peephole_instructions += removed;
+  free(chunk->code);
+  chunk->code = out.code;
+  chunk->size = out.size;
+  chunk->cap = out.cap;
+
+  free(new_pos);
+  free(peephole.ops);
+  free(index_at);
+  free(targets);
+  return removed;
+}
+
+void peephole_chunk(Chunk *chunk) {
+  assert(chunk->far_jumps_num == 0 && "relax the chunk first");
+  // taking something out can line up something else for the next round
+  while (peephole_round(chunk) != 0)
+    ;
+}
+
+static uint32_t add_program_number(Program *program, double number) {
+  if (program->numbers_num == program->numbers_cap) {
+    program->numbers_cap =
+        (program->numbers_cap == 0) ? 16 : program->numbers_cap * 2;
+    program->numbers = realloc(program->numbers, program->numbers_cap *
+                                                     sizeof(*program->numbers));
+    assert(program->numbers != NULL);
+  }
+
+  program->numbers[program->numbers_num++] = number;
+  return program->numbers_num - 1;
+}
+
+Program decode_chunk(const Chunk *chunk) {
+  // a chunk never holds more instructions than bytes, +1 for the halt
+  Program program = {
+      .size = 0,
+      .code = malloc((chunk->size + 1) * sizeof(*program.code)),
+
+      .numbers_num = 0,
+      .numbers_cap = 0,
+      .numbers = NULL,
+  };
+  assert(program.code != NULL);
+
+  // instruction index for every byte offset an instruction starts at
+  size_t *index_at = malloc((chunk->size + 1) * sizeof(*index_at));
+  assert(index_at != NULL);
+
+  size_t pos = 0;
+  while (pos < chunk->size) {
+    index_at[pos] = program.size;
+    Bytecode op = read_chunk_u8(chunk, &pos);
+    Instruction *instruction = &program.code[program.size++];
+    *instruction = (Instruction){
+        .op = op,
+    };
+
+    switch (op) {
+    case Bytecode_PushNumber:
+      instruction->constant =
+          add_program_number(&program, read_chunk_f64(chunk, &pos));
+      break;
+    case Bytecode_PushString:
+      instruction->operand = read_chunk_u16(chunk, &pos);
+      assert(instruction->operand < chunk->strings_num);
+      break;
+
+    case Bytecode_PopN:
+      instruction->arg = read_chunk_u8(chunk, &pos);
+      break;
+    case Bytecode_Load:
+    case Bytecode_Store:
+    case Bytecode_StorePop:
+      instruction->operand = read_chunk_u8(chunk, &pos);
+      break;
+    // decoded instructions have room for any slot, so the vm only ever sees
+    // the short forms
+    case Bytecode_LoadWide:
+      instruction->op = Bytecode_Load;
+      instruction->operand = read_chunk_u16(chunk, &pos);
+      break;
+    case Bytecode_StoreWide:
+      instruction->op = Bytecode_Store;
+      instruction->operand = read_chunk_u16(chunk, &pos);
+      break;
+
+    case Bytecode_NativeCall:
+      instruction->operand = read_chunk_u16(chunk, &pos);
+      instruction->arg = read_chunk_u8(chunk, &pos);
+      break;
+
+    // jumps hold the byte offset they land on until every instruction has an
+    // index
+    case Bytecode_JumpBack: {
+      uint16_t offset = read_chunk_u16(chunk, &pos);
+      instruction->operand = pos - offset;
+      break;
+    }
+    // the vm doesn't care how far away the target was
+    case Bytecode_JumpLong: {
+      instruction->op = Bytecode_Jump;
+      uint32_t offset = read_chunk_u32(chunk, &pos);
+      instruction->operand = pos + offset;
+      break;
+    }
+    case Bytecode_JumpBackLong: {
+      instruction->op = Bytecode_JumpBack;
+      uint32_t offset = read_chunk_u32(chunk, &pos);
+      instruction->operand = pos - offset;
+      break;
+    }
+    case Bytecode_Jump:
+    case Bytecode_JumpIfFalse:
+    case Bytecode_JumpIfTrue:
+    case Bytecode_JumpIfFalseRetain:
+    case Bytecode_JumpIfTrueRetain:
+    case Bytecode_JumpIfNotEqual:
+    case Bytecode_JumpIfEqual:
+    case Bytecode_JumpIfNotEqualNum:
+    case Bytecode_JumpIfEqualNum:
+    case Bytecode_JumpIfNotEqualBool:
+    case Bytecode_JumpIfEqualBool:
+    case Bytecode_JumpIfNotEqualStr:
+    case Bytecode_JumpIfEqualStr:
+    case Bytecode_JumpIfNotLess:
+    case Bytecode_JumpIfNotLessEqual:
+    case Bytecode_JumpIfNotGreater:
+    case Bytecode_JumpIfNotGreaterEqual: {
+      uint16_t offset = read_chunk_u16(chunk, &pos);
+      instruction->operand = pos + offset;
+      break;
+    }
+
+    case Bytecode_AddLocalConst:
+      instruction->arg = read_chunk_u8(chunk, &pos);
+      instruction->constant =
+          add_program_number(&program, read_chunk_f64(chunk, &pos));
+      break;
+    case Bytecode_IncLocalAndLoop: {
+      instruction->arg = read_chunk_u8(chunk, &pos);
+      instruction->constant =
+          add_program_number(&program, read_chunk_f64(chunk, &pos));
+      uint16_t offset = read_chunk_u16(chunk, &pos);
+      instruction->operand = pos - offset;
+      break;
+    }
+    case Bytecode_JumpIfNotLessLocalConst:
+    case Bytecode_JumpIfNotLessEqualLocalConst:
+    case Bytecode_JumpIfNotGreaterLocalConst:
+    case Bytecode_JumpIfNotGreaterEqualLocalConst: {
+      instruction->arg = read_chunk_u8(chunk, &pos);
+      instruction->constant =
+          add_program_number(&program, read_chunk_f64(chunk, &pos));
+      uint16_t offset = read_chunk_u16(chunk, &pos);
+      instruction->operand = pos + offset;
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+  index_at[pos] = program.size;
+  // running off the end of the chunk stops the vm
+  program.code[program.size++] = (Instruction){
+      .op = Bytecode_Halt,
+  };
+
+  for (size_t i = 0; i < program.size; i++) {
+    Instruction *instruction = &program.code[i];
+    if (!is_jump(instruction->op))
+      continue;
+
+    assert(instruction->operand <= chunk->size);
+    instruction->operand = index_at[instruction->operand];
+  }
+  free(index_at);
+
+  return program;
+}
+
+void delete_program(Program *program) {
+  free(program->code);
+  free(program->numbers);
+}
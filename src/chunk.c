@@ -1,4 +1,6 @@
 #include "chunk.h"
+#include "intern.h"
+#include "value.h"
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,36 +11,74 @@ Chunk new_chunk() {
   return (Chunk){
       .strings_num = 0,
       .strings = NULL,
+      .string_slots_cap = 0,
+      .string_slots = NULL,
 
       .size = 0,
       .cap = 0,
       .code = NULL,
+
+      .args_num = 0,
+      .arg_types = NULL,
+
+      .far_jumps_num = 0,
+      .far_jumps_cap = 0,
+      .far_jumps = NULL,
+
+      .peephole_instructions = 0,
+      .peephole_bytes = 0,
   };
 }
 
 void delete_chunk(Chunk *chunk) {
-  for (size_t i = 0; i < chunk->strings_num; i++)
-    free(chunk->strings[i].chars);
   free(chunk->strings);
+  free(chunk->string_slots);
   free(chunk->code);
+  free(chunk->arg_types);
+  free(chunk->far_jumps);
 }
 
-size_t add_chunk_string(Chunk *chunk, const char *chars, uint32_t len) {
+static uint32_t *find_string_slot(uint32_t *slots, size_t cap,
+                                   const Value *strings, ObjString *string) {
+  size_t mask = cap - 1;
+  for (size_t i = string->hash & mask;; i = (i + 1) & mask) {
+    // interned, so the same string is always the same object
+    if (slots[i] == 0 || value_as_string(strings[slots[i] - 1]) == string)
+      return &slots[i];
+  }
+}
+
+static void grow_string_slots(Chunk *chunk) {
+  size_t cap = chunk->string_slots_cap == 0 ? 16 : chunk->string_slots_cap * 2;
+  uint32_t *slots = calloc(cap, sizeof(*slots));
+  assert(slots != NULL);
+
   for (size_t i = 0; i < chunk->strings_num; i++) {
-    if (strncmp(chunk->strings[i].chars, chars, len) == 0)
-      return i; // already exists
+    ObjString *string = value_as_string(chunk->strings[i]);
+    *find_string_slot(slots, cap, chunk->strings, string) = i + 1;
   }
 
+  free(chunk->string_slots);
+  chunk->string_slots_cap = cap;
+  chunk->string_slots = slots;
+}
+
+size_t add_chunk_string(Chunk *chunk, const char *chars, uint32_t len) {
+  if ((chunk->strings_num + 1) * 4 > chunk->string_slots_cap * 3)
+    grow_string_slots(chunk);
+
+  Value value = intern_string(chars, len);
+  uint32_t *slot =
+      find_string_slot(chunk->string_slots, chunk->string_slots_cap,
+                       chunk->strings, value_as_string(value));
+  if (*slot != 0)
+    return *slot - 1; // already exists
+
   chunk->strings = realloc(chunk->strings,
                            (chunk->strings_num + 1) * sizeof(*chunk->strings));
   assert(chunk->strings != NULL);
-
-  char *chars_copy = strndup(chars, len);
-  assert(chars_copy != NULL);
-  chunk->strings[chunk->strings_num++] = (ChunkString){
-      .len = len,
-      .chars = chars_copy,
-  };
+  chunk->strings[chunk->strings_num++] = value;
+  *slot = chunk->strings_num;
 
   return chunk->strings_num - 1;
 }
@@ -96,9 +136,50 @@ size_t write_chunk_hole(Chunk *chunk, size_t bits) {
   return pos;
 }
 
+static void add_far_jump(Chunk *chunk, size_t hole, size_t target) {
+  if (chunk->far_jumps_num == chunk->far_jumps_cap) {
+    chunk->far_jumps_cap =
+        (chunk->far_jumps_cap == 0) ? 8 : chunk->far_jumps_cap * 2;
+    chunk->far_jumps = realloc(chunk->far_jumps, chunk->far_jumps_cap *
+                                                     sizeof(*chunk->far_jumps));
+    assert(chunk->far_jumps != NULL);
+  }
+  chunk->far_jumps[chunk->far_jumps_num++] = (ChunkFarJump){
+      .hole = hole,
+      .target = target,
+  };
+}
+
 void patch_chunk_hole_u16(Chunk *chunk, size_t pos) {
   size_t patch_pos = chunk->size;
+  size_t offset = patch_pos - pos - sizeof(uint16_t);
+  if (offset > UINT16_MAX) {
+    add_far_jump(chunk, pos, patch_pos);
+    offset = 0;
+  }
+
   chunk->size = pos; // why not?
-  write_chunk_u16(chunk, patch_pos - pos - sizeof(uint16_t));
+  write_chunk_u16(chunk, offset);
   chunk->size = patch_pos;
-}
\ No newline at end of file
+}
+
+void write_chunk_back_offset_u16(Chunk *chunk, size_t target) {
+  size_t offset = chunk->size + sizeof(uint16_t) - target;
+  if (offset > UINT16_MAX) {
+    add_far_jump(chunk, chunk->size, target);
+    offset = 0;
+  }
+  write_chunk_u16(chunk, offset);
+}
+
+void truncate_chunk(Chunk *chunk, size_t size) {
+  assert(size <= chunk->size);
+  chunk->size = size;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < chunk->far_jumps_num; i++) {
+    if (chunk->far_jumps[i].hole < size)
+      chunk->far_jumps[kept++] = chunk->far_jumps[i];
+  }
+  chunk->far_jumps_num = kept;
+}
@@ -1,8 +1,13 @@
 #include "expr.h"
+#include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 #include "type_def.h"
 #include "value.h"
 #include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 BinaryOp token_to_binary_op(TokenType type) {
@@ -38,50 +43,52 @@ BinaryOp token_to_binary_op(TokenType type) {
   }
 }
 
-Expr *new_expr(ExprType type, TypeDef return_type) {
-  Expr *expr = malloc(sizeof(*expr));
-  assert(expr != NULL);
+Expr *new_expr(Arena *arena, ExprType type, TypeDef return_type) {
+  Expr *expr = arena_alloc(arena, sizeof(*expr));
   expr->type = type;
   expr->return_type = return_type;
   expr->next = NULL;
   return expr;
 }
 
-Expr *new_literal_expr(Value value) {
-  Expr *expr = new_expr(ExprType_Literal, new_type_def(value.type, false));
+Expr *new_literal_expr(Arena *arena, Value value) {
+  assert(is_value_primitive(value) || value_as_string(value)->interned);
+  Expr *expr = new_expr(arena, ExprType_Literal,
+                        new_type_def(value_type(value), false));
   expr->literal = value;
   return expr;
 }
 
-Expr *new_get_var_expr(size_t idx, TypeDef type) {
-  Expr *expr = new_expr(ExprType_GetVar, type);
+Expr *new_get_var_expr(Arena *arena, size_t idx, TypeDef type) {
+  Expr *expr = new_expr(arena, ExprType_GetVar, type);
   expr->get_var.idx = idx;
   return expr;
 }
 
-Expr *new_set_var_expr(size_t idx, Expr *value) {
-  Expr *expr = new_expr(ExprType_SetVar, value->return_type);
+Expr *new_set_var_expr(Arena *arena, size_t idx, Expr *value) {
+  Expr *expr = new_expr(arena, ExprType_SetVar, value->return_type);
   expr->set_var.idx = idx;
   expr->set_var.value = value;
   return expr;
 }
 
-Expr *new_native_call_expr(size_t idx, TypeDef return_type, Expr *argv_head) {
-  Expr *expr = new_expr(ExprType_NativeCall, return_type);
+Expr *new_native_call_expr(Arena *arena, size_t idx, TypeDef return_type,
+                           Expr *argv_head) {
+  Expr *expr = new_expr(arena, ExprType_NativeCall, return_type);
   expr->call.idx = idx;
   expr->call.argv_head = argv_head;
   return expr;
 }
 
-Expr *new_unary_expr(UnaryOp op, Expr *operand) {
-  Expr *expr = new_expr(ExprType_Unary, operand->return_type);
+Expr *new_unary_expr(Arena *arena, UnaryOp op, Expr *operand) {
+  Expr *expr = new_expr(arena, ExprType_Unary, operand->return_type);
   expr->unary.op = op;
   expr->unary.operand = operand;
   return expr;
 }
 
-Expr *new_binary_expr(BinaryOp op, Expr *lhs, Expr *rhs) {
-  Expr *expr = new_expr(ExprType_Binary, lhs->return_type);
+Expr *new_binary_expr(Arena *arena, BinaryOp op, Expr *lhs, Expr *rhs) {
+  Expr *expr = new_expr(arena, ExprType_Binary, lhs->return_type);
   if (op >= BinaryOp_Equal)
     expr->return_type = TypeDef_Boolean;
   expr->binary.op = op;
@@ -90,87 +97,200 @@ Expr *new_binary_expr(BinaryOp op, Expr *lhs, Expr *rhs) {
   return expr;
 }
 
-void delete_expr(Expr *expr) {
-  if (expr->next != NULL)
-    delete_expr(expr->next);
-
+// whether evaluating expr can change anything, so it's safe to drop
+static bool is_expr_pure(const Expr *expr) {
   switch (expr->type) {
   case ExprType_Literal:
-    release_value(expr->literal);
-    break;
   case ExprType_GetVar:
-    break;
+    return true;
   case ExprType_SetVar:
-    delete_expr(expr->set_var.value);
+  case ExprType_NativeCall:
+    return false;
+  case ExprType_Unary:
+    return is_expr_pure(expr->unary.operand);
+  case ExprType_Binary:
+    return is_expr_pure(expr->binary.lhs) && is_expr_pure(expr->binary.rhs);
+  }
+  return false;
+}
+
+static bool is_number_literal(const Expr *expr, double number, bool negative) {
+  if (expr->type != ExprType_Literal ||
+      value_type(expr->literal) != ValueType_Number)
+    return false;
+  double literal = value_as_number(expr->literal);
+  return literal == number && (signbit(literal) != 0) == negative;
+}
+
+static bool is_boolean_literal(const Expr *expr, bool boolean) {
+  return expr->type == ExprType_Literal &&
+         value_type(expr->literal) == ValueType_Boolean &&
+         value_as_boolean(expr->literal) == boolean;
+}
+
+static bool is_empty_string_literal(const Expr *expr) {
+  return expr->type == ExprType_Literal &&
+         value_type(expr->literal) == ValueType_String &&
+         value_as_string(expr->literal)->len == 0;
+}
+
+// takes over what another expr does, keeping its own place in an argument
+// list
+static void replace_expr(Expr *expr, const Expr *with) {
+  Expr *next = expr->next;
+  *expr = *with;
+  expr->next = next;
+}
+
+static void replace_with_literal(Expr *expr, Value literal) {
+  expr->type = ExprType_Literal;
+  expr->literal = literal;
+}
+
+// rewrites an op with a single literal operand into something cheaper, the
+// operand has to leave the result exactly the same. x + 0 isn't one of them,
+// -0 + 0 is 0
+static void fold_identity(Expr *expr) {
+  Expr *lhs = expr->binary.lhs, *rhs = expr->binary.rhs;
+  switch (expr->binary.op) {
+  case BinaryOp_Add:
+    if (is_type_def_string(expr->return_type)) {
+      if (is_empty_string_literal(rhs))
+        replace_expr(expr, lhs);
+      else if (is_empty_string_literal(lhs))
+        replace_expr(expr, rhs);
+    } else if (is_number_literal(rhs, 0.0, true)) {
+      replace_expr(expr, lhs);
+    } else if (is_number_literal(lhs, 0.0, true)) {
+      replace_expr(expr, rhs);
+    }
+    break;
+  case BinaryOp_Subtract:
+    if (is_number_literal(rhs, 0.0, false))
+      replace_expr(expr, lhs);
+    break;
+  case BinaryOp_Multiply:
+    if (is_number_literal(rhs, 1.0, false))
+      replace_expr(expr, lhs);
+    else if (is_number_literal(lhs, 1.0, false))
+      replace_expr(expr, rhs);
+    break;
+  case BinaryOp_Divide:
+    if (is_number_literal(rhs, 1.0, false))
+      replace_expr(expr, lhs);
     break;
 
-  case ExprType_NativeCall:
-    if (expr->call.argv_head != NULL)
-      delete_expr(expr->call.argv_head);
+  // comparing a boolean against a constant is the boolean itself or its
+  // negation, as long as it can't be null
+  case BinaryOp_Equal:
+  case BinaryOp_NotEqual: {
+    if (common_type_def(lhs->return_type, rhs->return_type) !=
+        ValueType_Boolean)
+      break;
+    const Expr *literal = rhs, *other = lhs;
+    if (lhs->type == ExprType_Literal) {
+      literal = lhs;
+      other = rhs;
+    }
+    if (literal->type != ExprType_Literal)
+      break;
+
+    bool negate = (value_as_boolean(literal->literal) !=
+                   (expr->binary.op == BinaryOp_Equal));
+    if (!negate) {
+      replace_expr(expr, other);
+    } else {
+      expr->type = ExprType_Unary;
+      expr->unary.op = UnaryOp_Not;
+      expr->unary.operand = (Expr *)other;
+      fold_expr(expr);
+    }
     break;
+  }
 
-  case ExprType_Unary:
-    delete_expr(expr->unary.operand);
+  // the lhs always runs, the rhs only runs when the lhs doesn't decide it
+  case BinaryOp_And:
+    if (is_boolean_literal(lhs, true))
+      replace_expr(expr, rhs);
+    else if (is_boolean_literal(lhs, false))
+      replace_with_literal(expr, new_boolean_value(false));
+    else if (is_boolean_literal(rhs, true))
+      replace_expr(expr, lhs);
+    else if (is_boolean_literal(rhs, false) && is_expr_pure(lhs))
+      replace_with_literal(expr, new_boolean_value(false));
     break;
-  case ExprType_Binary:
-    delete_expr(expr->binary.rhs);
-    delete_expr(expr->binary.lhs);
+  case BinaryOp_Or:
+    if (is_boolean_literal(lhs, false))
+      replace_expr(expr, rhs);
+    else if (is_boolean_literal(lhs, true))
+      replace_with_literal(expr, new_boolean_value(true));
+    else if (is_boolean_literal(rhs, false))
+      replace_expr(expr, lhs);
+    else if (is_boolean_literal(rhs, true) && is_expr_pure(lhs))
+      replace_with_literal(expr, new_boolean_value(true));
+    break;
+
+  default:
     break;
   }
-  free(expr);
 }
 
-void simplify_expr(Expr *expr) {
+void fold_expr(Expr *expr) {
   switch (expr->type) {
   case ExprType_Literal:
   case ExprType_GetVar:
-    break;
   case ExprType_SetVar:
-    simplify_expr(expr->set_var.value);
-    break;
-
   case ExprType_NativeCall:
-    for (Expr *arg = expr->call.argv_head; arg != NULL; arg = arg->next)
-      simplify_expr(arg);
     break;
 
   case ExprType_Unary: {
-    simplify_expr(expr->unary.operand);
     Expr *operand = expr->unary.operand;
+    // -(-x) and !(!x)
+    if (operand->type == ExprType_Unary &&
+        operand->unary.op == expr->unary.op) {
+      replace_expr(expr, operand->unary.operand);
+      break;
+    }
     if (operand->type != ExprType_Literal)
       break;
 
-    expr->type = ExprType_Literal;
     switch (expr->unary.op) {
     case UnaryOp_Negate:
-      expr->literal = new_number_value(-value_as_number(operand->literal));
+      replace_with_literal(
+          expr, new_number_value(-value_as_number(operand->literal)));
       break;
     case UnaryOp_Not:
-      expr->literal = new_boolean_value(!value_as_boolean(operand->literal));
+      replace_with_literal(
+          expr, new_boolean_value(!value_as_boolean(operand->literal)));
       break;
     }
-
-    delete_expr(operand);
     break;
   }
   case ExprType_Binary: {
-    simplify_expr(expr->binary.lhs);
-    simplify_expr(expr->binary.rhs);
     Expr *lhs_expr = expr->binary.lhs, *rhs_expr = expr->binary.rhs;
     if (lhs_expr->type != ExprType_Literal ||
-        rhs_expr->type != ExprType_Literal)
+        rhs_expr->type != ExprType_Literal) {
+      fold_identity(expr);
       break;
+    }
     Value lhs = lhs_expr->literal, rhs = rhs_expr->literal;
 
     expr->type = ExprType_Literal;
     switch (expr->binary.op) {
     case BinaryOp_Add:
-      if (lhs.type == ValueType_Number) {
+      if (value_type(lhs) == ValueType_Number) {
         expr->literal =
             new_number_value(value_as_number(lhs) + value_as_number(rhs));
       } else {
-        // string concat?
-        expr->literal = value_concat(lhs, rhs);
+        // string concat, interned like any other string literal
+        Value concat;
+        if (!value_concat(lhs, rhs, &concat)) {
+          puts("string literal too long");
+          exit(-1);
+        }
+        ObjString *string = value_as_string(concat);
+        expr->literal = intern_string(string_chars(string), string->len);
+        release_value(concat);
       }
       break;
     case BinaryOp_Subtract:
@@ -218,10 +338,32 @@ void simplify_expr(Expr *expr) {
           new_boolean_value(value_as_boolean(lhs) || value_as_boolean(rhs));
       break;
     }
-
-    delete_expr(rhs_expr);
-    delete_expr(lhs_expr);
     break;
   }
   }
-}
\ No newline at end of file
+}
+
+void simplify_expr(Expr *expr) {
+  switch (expr->type) {
+  case ExprType_Literal:
+  case ExprType_GetVar:
+    break;
+  case ExprType_SetVar:
+    simplify_expr(expr->set_var.value);
+    break;
+
+  case ExprType_NativeCall:
+    for (Expr *arg = expr->call.argv_head; arg != NULL; arg = arg->next)
+      simplify_expr(arg);
+    break;
+
+  case ExprType_Unary:
+    simplify_expr(expr->unary.operand);
+    break;
+  case ExprType_Binary:
+    simplify_expr(expr->binary.lhs);
+    simplify_expr(expr->binary.rhs);
+    break;
+  }
+  fold_expr(expr);
+}
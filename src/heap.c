@@ -0,0 +1,161 @@
+#include "heap.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static const size_t CLASS_SIZES[HEAP_CLASSES_NUM] = {
+    16, 32, 48, 64, 96, 128, 192, HEAP_MAX_CLASS_SIZE,
+};
+
+// sits at the start of every slab, slabs are aligned to their size so a block
+// finds its slab by masking its address
+typedef struct HeapSlab {
+  Heap *heap;
+  struct HeapSlab *next;
+  size_t size_class;
+} HeapSlab;
+
+// blocks start this far into a slab, keeping them 16 byte aligned
+#define SLAB_HEADER_SIZE ((sizeof(HeapSlab) + 15) & ~(size_t)15)
+
+typedef struct HeapBlock {
+  struct HeapBlock *next;
+} HeapBlock;
+
+// put in front of allocations that don't fit a size class
+typedef struct HeapLarge {
+  Heap *heap;
+  struct HeapLarge *prev, *next;
+  size_t pad; // keeps the allocation after it 16 byte aligned
+} HeapLarge;
+
+// every thread allocates from its own heaps, NULL means the default one
+static _Thread_local Heap default_heap = {};
+static _Thread_local Heap *current_heap = NULL;
+
+Heap *new_heap() {
+  Heap *heap = calloc(1, sizeof(*heap));
+  assert(heap != NULL);
+  return heap;
+}
+
+void delete_heap(Heap *heap) {
+  assert(heap != &default_heap && heap != get_current_heap());
+
+  for (HeapSlab *slab = heap->slabs; slab != NULL;) {
+    HeapSlab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  for (HeapLarge *large = heap->large; large != NULL;) {
+    HeapLarge *next = large->next;
+    free(large);
+    large = next;
+  }
+  free(heap);
+}
+
+static size_t size_class_of(size_t size) {
+  size_t size_class = 0;
+  while (CLASS_SIZES[size_class] < size)
+    size_class++;
+  return size_class;
+}
+
+static void *alloc_large(Heap *heap, size_t size) {
+  HeapLarge *large = malloc(sizeof(*large) + size);
+  assert(large != NULL);
+  large->heap = heap;
+  large->prev = NULL;
+  large->next = heap->large;
+  if (heap->large != NULL)
+    heap->large->prev = large;
+  heap->large = large;
+
+  heap->stats.large_allocs++;
+  return large + 1;
+}
+
+static void add_slab(Heap *heap, size_t size_class) {
+  HeapSlab *slab = aligned_alloc(HEAP_SLAB_SIZE, HEAP_SLAB_SIZE);
+  assert(slab != NULL);
+  slab->heap = heap;
+  slab->next = heap->slabs;
+  slab->size_class = size_class;
+  heap->slabs = slab;
+  heap->stats.slabs_num++;
+
+  HeapClass *heap_class = &heap->classes[size_class];
+  heap_class->bump = (char *)slab + SLAB_HEADER_SIZE;
+  heap_class->bump_end = (char *)slab + HEAP_SLAB_SIZE;
+}
+
+void *heap_alloc(Heap *heap, size_t size) {
+  heap->stats.allocs++;
+  heap->stats.live_bytes += size;
+  if (heap->stats.live_bytes > heap->stats.peak_bytes)
+    heap->stats.peak_bytes = heap->stats.live_bytes;
+
+  if (size > HEAP_MAX_CLASS_SIZE)
+    return alloc_large(heap, size);
+
+  size_t size_class = size_class_of(size);
+  HeapClass *heap_class = &heap->classes[size_class];
+  if (heap_class->free_list != NULL) {
+    HeapBlock *block = heap_class->free_list;
+    heap_class->free_list = block->next;
+    return block;
+  }
+
+  size_t block_size = CLASS_SIZES[size_class];
+  if (heap_class->bump == NULL ||
+      (size_t)(heap_class->bump_end - heap_class->bump) < block_size)
+    add_slab(heap, size_class);
+
+  void *block = heap_class->bump;
+  heap_class->bump += block_size;
+  return block;
+}
+
+void heap_free(void *ptr, size_t size) {
+  if (ptr == NULL)
+    return;
+
+  Heap *heap;
+  if (size > HEAP_MAX_CLASS_SIZE) {
+    HeapLarge *large = (HeapLarge *)ptr - 1;
+    heap = large->heap;
+    if (large->prev != NULL)
+      large->prev->next = large->next;
+    else
+      heap->large = large->next;
+    if (large->next != NULL)
+      large->next->prev = large->prev;
+    free(large);
+  } else {
+    HeapSlab *slab =
+        (HeapSlab *)((uintptr_t)ptr & ~(uintptr_t)(HEAP_SLAB_SIZE - 1));
+    heap = slab->heap;
+    assert(slab->size_class == size_class_of(size));
+
+    HeapBlock *block = ptr;
+    block->next = heap->classes[slab->size_class].free_list;
+    heap->classes[slab->size_class].free_list = block;
+  }
+
+  heap->stats.frees++;
+  heap->stats.live_bytes -= size;
+}
+
+HeapStats get_heap_stats(const Heap *heap) { return heap->stats; }
+
+Heap *get_current_heap() {
+  return current_heap != NULL ? current_heap : &default_heap;
+}
+
+Heap *set_current_heap(Heap *heap) {
+  Heap *previous = get_current_heap();
+  current_heap = heap;
+  return previous;
+}
@@ -0,0 +1,98 @@
+#include "intern.h"
+#include "heap.h"
+#include "utility.h"
+#include "value.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct StringTable {
+  size_t count, cap; // cap is always a power of 2
+  ObjString **entries;
+  // the strings themselves, so they don't land in whatever heap happens to
+  // be current
+  Heap *heap;
+} StringTable;
+
+// shared by every thread, but only compiling interns so the lock is cheap
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static StringTable table = {
+    .count = 0,
+    .cap = 0,
+    .entries = NULL,
+    .heap = NULL,
+};
+
+static ObjString **find_entry(ObjString **entries, size_t cap,
+                              const char *chars, uint32_t len, uint32_t hash) {
+  size_t mask = cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    ObjString *string = entries[i];
+    if (string == NULL)
+      return &entries[i];
+    if (string->hash == hash &&
+        compare_string(string->chars, string->len, chars, len))
+      return &entries[i];
+  }
+}
+
+static void grow_table() {
+  size_t cap = table.cap == 0 ? 64 : table.cap * 2;
+  ObjString **entries = calloc(cap, sizeof(*entries));
+  assert(entries != NULL);
+
+  for (size_t i = 0; i < table.cap; i++) {
+    ObjString *string = table.entries[i];
+    if (string != NULL)
+      *find_entry(entries, cap, string->chars, string->len, string->hash) =
+          string;
+  }
+
+  free(table.entries);
+  table.cap = cap;
+  table.entries = entries;
+}
+
+Value intern_string(const char *chars, uint32_t len) {
+  pthread_mutex_lock(&table_lock);
+  // keep the load factor under 3/4
+  if ((table.count + 1) * 4 > table.cap * 3)
+    grow_table();
+
+  uint32_t hash = hash_string(chars, len);
+  ObjString **entry = find_entry(table.entries, table.cap, chars, len, hash);
+  if (*entry == NULL) {
+    if (table.heap == NULL)
+      table.heap = new_heap();
+    Heap *previous_heap = set_current_heap(table.heap);
+    ObjString *string =
+        value_as_string(new_immortal_string_value(chars, len));
+    set_current_heap(previous_heap);
+    string->interned = true;
+
+    *entry = string;
+    table.count++;
+  }
+
+  Value value = new_string_object_value(*entry);
+  pthread_mutex_unlock(&table_lock);
+  return value;
+}
+
+void free_interned_strings() {
+  pthread_mutex_lock(&table_lock);
+  // every string lives in the table's heap, so they all go at once
+  if (table.heap != NULL)
+    delete_heap(table.heap);
+  free(table.entries);
+  table = (StringTable){
+      .count = 0,
+      .cap = 0,
+      .entries = NULL,
+      .heap = NULL,
+  };
+  pthread_mutex_unlock(&table_lock);
+}
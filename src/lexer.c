@@ -1,37 +1,177 @@
 #include "lexer.h"
-#include "utility.h"
 #include <assert.h>
-#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct Keyword {
-  const char *text;
-  TokenType type;
-  LexerContext context;
-} Keyword;
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+  CharClass_Space = 1 << 0,
+  CharClass_Digit = 1 << 1,
+  CharClass_Alpha = 1 << 2, // '_' counts as a letter too
+};
 
 // clang-format off
-static const Keyword KEYWORDS[] = {
-    {"null",     TokenType_Null,     LexerContext_None},
-    {"true",     TokenType_True,     LexerContext_None},
-    {"false",    TokenType_False,    LexerContext_None},
-    {"let",      TokenType_Let,      LexerContext_None},
-    {"if",       TokenType_If,       LexerContext_None},
-    {"else",     TokenType_Else,     LexerContext_None},
-    {"while",    TokenType_While,    LexerContext_None},
-    {"for",      TokenType_For,      LexerContext_None},
-    {"in",       TokenType_In,       LexerContext_For},
-    {"by",       TokenType_By,       LexerContext_For},
-    {"break",    TokenType_Break,    LexerContext_None},
-    {"continue", TokenType_Continue, LexerContext_None},
-    {NULL, 0, 0},
+static const uint8_t CHAR_CLASSES[256] = {
+    [' '] = CharClass_Space,  ['\t'] = CharClass_Space,
+    ['\n'] = CharClass_Space, ['\v'] = CharClass_Space,
+    ['\f'] = CharClass_Space, ['\r'] = CharClass_Space,
+
+    ['0' ... '9'] = CharClass_Digit,
+
+    ['a' ... 'z'] = CharClass_Alpha,
+    ['A' ... 'Z'] = CharClass_Alpha,
+    ['_'] = CharClass_Alpha,
 };
 // clang-format on
 
-static char peek(const Lexer *lexer) { return lexer->source[lexer->pos]; }
+static bool is_class(char ch, uint8_t classes) {
+  return (CHAR_CLASSES[(uint8_t)ch] & classes) != 0;
+}
+
+// the scans below return how many characters starting at pos belong to a run,
+// 16 at a time with SSE2 as long as there's that much source left
+#ifdef __SSE2__
+static __m128i load_chunk(const char *source, size_t pos) {
+  return _mm_loadu_si128((const __m128i *)(source + pos));
+}
+
+// true in every lane where lo <= chunk <= hi, comparing unsigned
+static __m128i in_range(__m128i chunk, char lo, char hi) {
+  __m128i offset = _mm_sub_epi8(chunk, _mm_set1_epi8(lo));
+  __m128i limit = _mm_set1_epi8((char)(hi - lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(offset, limit), offset);
+}
+
+// the lanes that are still part of the run, as a bitmask
+static unsigned space_mask(__m128i chunk) {
+  __m128i space = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+  space = _mm_or_si128(space, in_range(chunk, '\t', '\r'));
+  return _mm_movemask_epi8(space);
+}
+
+static unsigned ident_mask(__m128i chunk) {
+  __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+  __m128i ident = in_range(lower, 'a', 'z');
+  ident = _mm_or_si128(ident, in_range(chunk, '0', '9'));
+  ident = _mm_or_si128(ident, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+  return _mm_movemask_epi8(ident);
+}
+
+static unsigned string_body_mask(__m128i chunk) {
+  __m128i end = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'));
+  end = _mm_or_si128(end, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')));
+  end = _mm_or_si128(end, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+  end = _mm_or_si128(end, _mm_cmpeq_epi8(chunk, _mm_setzero_si128()));
+  return ~_mm_movemask_epi8(end) & 0xffff;
+}
+
+#define SCAN_FN(name, mask_fn, scalar_cond)                                    \
+  static size_t name(const Lexer *lexer, size_t pos) {                         \
+    size_t start = pos;                                                        \
+    while (pos + 16 <= lexer->len) {                                           \
+      unsigned mask = mask_fn(load_chunk(lexer->source, pos));                 \
+      if (mask != 0xffff)                                                      \
+        return pos + __builtin_ctz(~mask) - start;                             \
+      pos += 16;                                                               \
+    }                                                                          \
+    for (; pos < lexer->len; pos++) {                                          \
+      char ch = lexer->source[pos];                                            \
+      if (!(scalar_cond))                                                      \
+        break;                                                                 \
+    }                                                                          \
+    return pos - start;                                                        \
+  }
+#else
+#define SCAN_FN(name, mask_fn, scalar_cond)                                    \
+  static size_t name(const Lexer *lexer, size_t pos) {                         \
+    size_t start = pos;                                                        \
+    for (; pos < lexer->len; pos++) {                                          \
+      char ch = lexer->source[pos];                                            \
+      if (!(scalar_cond))                                                      \
+        break;                                                                 \
+    }                                                                          \
+    return pos - start;                                                        \
+  }
+#endif
+
+SCAN_FN(scan_space, space_mask, is_class(ch, CharClass_Space))
+SCAN_FN(scan_ident, ident_mask,
+        is_class(ch, CharClass_Alpha | CharClass_Digit))
+SCAN_FN(scan_string_body, string_body_mask,
+        ch != '"' && ch != '\r' && ch != '\n' && ch != 0)
+#undef SCAN_FN
+
+static TokenType check_keyword(const char *text, size_t len,
+                               const char *keyword, TokenType type) {
+  return memcmp(text, keyword, len) == 0 ? type : TokenType_Identifier;
+}
+
+// picks the only keyword an identifier could be by its length and first
+// character, then compares against just that one
+static TokenType keyword_type(const char *text, size_t len,
+                              LexerContext context) {
+  switch (len) {
+  case 2:
+    switch (text[0]) {
+    case 'i':
+      if (text[1] == 'f')
+        return TokenType_If;
+      // context-based keywords are plain identifiers outside their context
+      if (context == LexerContext_For)
+        return check_keyword(text, len, "in", TokenType_In);
+      break;
+    case 'b':
+      if (context == LexerContext_For)
+        return check_keyword(text, len, "by", TokenType_By);
+      break;
+    }
+    break;
+  case 3:
+    switch (text[0]) {
+    case 'l':
+      return check_keyword(text, len, "let", TokenType_Let);
+    case 'f':
+      return check_keyword(text, len, "for", TokenType_For);
+    }
+    break;
+  case 4:
+    switch (text[0]) {
+    case 'n':
+      return check_keyword(text, len, "null", TokenType_Null);
+    case 't':
+      return check_keyword(text, len, "true", TokenType_True);
+    case 'e':
+      return check_keyword(text, len, "else", TokenType_Else);
+    }
+    break;
+  case 5:
+    switch (text[0]) {
+    case 'f':
+      return check_keyword(text, len, "false", TokenType_False);
+    case 'w':
+      return check_keyword(text, len, "while", TokenType_While);
+    case 'b':
+      return check_keyword(text, len, "break", TokenType_Break);
+    }
+    break;
+  case 6:
+    return check_keyword(text, len, "return", TokenType_Return);
+  case 8:
+    return check_keyword(text, len, "continue", TokenType_Continue);
+  }
+  return TokenType_Identifier;
+}
+
+// the source isn't nul terminated, running off the end reads as a 0
+static char peek(const Lexer *lexer) {
+  return lexer->pos < lexer->len ? lexer->source[lexer->pos] : 0;
+}
 
 static char advance(Lexer *lexer) {
   char ch = peek(lexer);
@@ -76,23 +216,35 @@ static Token emit_text(Lexer *lexer, TokenType type, size_t start_pos,
 
 static Token number(Lexer *lexer) {
   size_t start_pos = lexer->pos - 1;
-  while (isdigit(peek(lexer)))
+  while (is_class(peek(lexer), CharClass_Digit))
     advance(lexer);
 
   char delim = peek(lexer);
   if (delim == '.' || delim == 'x' || delim == 'X') {
     advance(lexer);
-    while (isdigit(peek(lexer)))
+    while (is_class(peek(lexer), CharClass_Digit))
       advance(lexer);
   }
 
-  return emit_number(lexer, TokenType_Number, atof(lexer->source + start_pos));
+  // strtod wants a terminator, the source might not have one right after.
+  // literals almost always fit on the stack, the rare long one goes to the
+  // heap
+  char small_text[64];
+  size_t len = lexer->pos - start_pos;
+  char *text = (len < sizeof(small_text)) ? small_text : malloc(len + 1);
+  assert(text != NULL);
+  memcpy(text, lexer->source + start_pos, len);
+  text[len] = 0;
+
+  double number = strtod(text, NULL);
+  if (text != small_text)
+    free(text);
+  return emit_number(lexer, TokenType_Number, number);
 }
 
 static Token string(Lexer *lexer) {
   size_t start_pos = lexer->pos;
-  while (peek(lexer) != '\r' && peek(lexer) != '\n' && peek(lexer) != '"')
-    advance(lexer);
+  lexer->pos += scan_string_body(lexer, lexer->pos);
   size_t len = lexer->pos - start_pos;
   if (!match(lexer, '"')) {
     puts("expected '\"' to close '\"'");
@@ -104,44 +256,18 @@ static Token string(Lexer *lexer) {
 
 static Token identifier(Lexer *lexer) {
   size_t start_pos = lexer->pos - 1;
-  while (isalnum(peek(lexer)) || peek(lexer) == '_')
-    advance(lexer);
+  lexer->pos += scan_ident(lexer, lexer->pos);
   size_t len = lexer->pos - start_pos;
 
-  for (const Keyword *keyword = KEYWORDS; keyword->text != NULL; keyword++) {
-    if (compare_string(lexer->source + start_pos, len, keyword->text,
-                       strlen(keyword->text))) {
-      if (keyword->context != LexerContext_None &&
-          keyword->context != lexer->context) {
-        // context-based keyword that didn't match the current context, treat
-        // this as an identifier
-        break;
-      }
-      return emit(lexer, keyword->type);
-    }
-  }
+  TokenType type =
+      keyword_type(lexer->source + start_pos, len, lexer->context);
+  if (type != TokenType_Identifier)
+    return emit(lexer, type);
   return emit_text(lexer, TokenType_Identifier, start_pos, len);
 }
 
-Lexer new_lexer(const char *source) {
-  Lexer lexer = {
-      .source = source,
-      .pos = 0,
-
-      .context = LexerContext_None,
-
-      .token = {},
-  };
-  lexer_advance(&lexer);
-
-  return lexer;
-}
-
-Token lexer_peek(const Lexer *lexer) { return lexer->token; }
-
-Token lexer_advance(Lexer *lexer) {
-  while (isspace(peek(lexer)))
-    advance(lexer);
+static Token lex_token(Lexer *lexer) {
+  lexer->pos += scan_space(lexer, lexer->pos);
 
   char ch = advance(lexer);
   switch (ch) {
@@ -162,7 +288,7 @@ Token lexer_advance(Lexer *lexer) {
     return emit(lexer, TokenType_RBracket);
 
   case '.':
-    if (isdigit(peek(lexer)))
+    if (is_class(peek(lexer), CharClass_Digit))
       return number(lexer);
     if (match(lexer, '.')) {
       if (match(lexer, '.'))
@@ -219,10 +345,117 @@ Token lexer_advance(Lexer *lexer) {
     return string(lexer);
 
   default:
-    if (isdigit(ch))
+    if (is_class(ch, CharClass_Digit))
       return number(lexer);
-    else if (isalpha(ch) || ch == '_')
+    else if (is_class(ch, CharClass_Alpha))
       return identifier(lexer);
     return emit(lexer, TokenType_Error);
   }
-}
\ No newline at end of file
+}
+
+static Token unpack_token(const Lexer *lexer, const PackedToken *packed) {
+  Token token = {
+      .type = packed->type,
+  };
+  switch (token.type) {
+  case TokenType_Number:
+    token.number = packed->number;
+    break;
+  case TokenType_Identifier:
+    // context-based keywords depend on where the parser is now, not on where
+    // the lexer was when it went over them
+    if (lexer->context != LexerContext_None) {
+      token.type = keyword_type(lexer->source + packed->offset, packed->len,
+                                lexer->context);
+      if (token.type != TokenType_Identifier)
+        break;
+    }
+    // fallthrough
+  case TokenType_String:
+    token.text.start = lexer->source + packed->offset;
+    token.text.len = packed->len;
+    break;
+  default:
+    break;
+  }
+  return token;
+}
+
+static void pack_token(Lexer *lexer, Token token, size_t *cap) {
+  if (lexer->tokens_num == *cap) {
+    *cap = *cap == 0 ? 256 : *cap * 2;
+    lexer->tokens = realloc(lexer->tokens, *cap * sizeof(*lexer->tokens));
+    assert(lexer->tokens != NULL);
+  }
+
+  PackedToken *packed = &lexer->tokens[lexer->tokens_num++];
+  packed->type = token.type;
+  packed->len = 0;
+  switch (token.type) {
+  case TokenType_Number:
+    packed->number = token.number;
+    break;
+  case TokenType_Identifier:
+  case TokenType_String:
+    assert(token.text.len <= UINT32_MAX);
+    packed->len = token.text.len;
+    packed->offset = token.text.start - lexer->source;
+    break;
+  default:
+    break;
+  }
+}
+
+Lexer new_lexer(const char *source, size_t len) {
+  Lexer lexer = {
+      .source = source,
+      .len = len,
+      .pos = 0,
+
+      .context = LexerContext_None,
+
+      .token = {},
+
+      .tokens = NULL,
+      .tokens_num = 0,
+      .token_idx = 0,
+  };
+  lexer_advance(&lexer);
+
+  return lexer;
+}
+
+Lexer new_buffered_lexer(const char *source, size_t len) {
+  Lexer lexer = new_lexer(source, len);
+  // tokens are packed with u32 offsets
+  if (lexer.len > UINT32_MAX) {
+    puts("source too big for token offsets");
+    exit(-1);
+  }
+
+  size_t cap = 0;
+  for (;;) {
+    pack_token(&lexer, lexer.token, &cap);
+    if (lexer.token.type == TokenType_Eof)
+      break;
+    lex_token(&lexer);
+  }
+
+  lexer.token = unpack_token(&lexer, &lexer.tokens[0]);
+  return lexer;
+}
+
+void delete_lexer(Lexer *lexer) { free(lexer->tokens); }
+
+Token lexer_peek(const Lexer *lexer) { return lexer->token; }
+
+Token lexer_advance(Lexer *lexer) {
+  if (lexer->tokens == NULL)
+    return lex_token(lexer);
+
+  // the last token is always eof, which stays put
+  if (lexer->token_idx + 1 < lexer->tokens_num)
+    lexer->token_idx++;
+  lexer->token = unpack_token(lexer, &lexer->tokens[lexer->token_idx]);
+  return lexer->token;
+}
@@ -1,10 +1,20 @@
 #include "bytecode.h"
+#include "heap.h"
+#include "intern.h"
 #include "parser.h"
+#include "pbc.h"
+#include "reg_bytecode.h"
+#include "reg_chunk.h"
+#include "reg_vm.h"
 #include "registry.h"
+#include "runner.h"
+#include "source.h"
 #include "type_def.h"
 #include "value.h"
 #include "vm.h"
 #include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,7 +24,7 @@
 Value script_print(Vm *vm, size_t argc, Value argv[]) {
   for (size_t i = 0; i < argc; i++) {
     Value arg = argv[i];
-    switch (arg.type) {
+    switch (value_type(arg)) {
     case ValueType_Error:
     case ValueType_Void:
       assert(0);
@@ -22,15 +32,17 @@ Value script_print(Vm *vm, size_t argc, Value argv[]) {
       fputs("null", stdout);
       break;
     case ValueType_Number:
-      printf("%g", arg.number);
+      printf("%g", value_as_number(arg));
       break;
     case ValueType_Boolean:
-      fputs(arg.boolean ? "true" : "false", stdout);
+      fputs(value_as_boolean(arg) ? "true" : "false", stdout);
       break;
-    case ValueType_String:
-      fputs(arg.string->chars, stdout);
+    case ValueType_String: {
+      ObjString *string = value_as_string(arg);
+      fwrite(string_chars(string), 1, string->len, stdout);
       break;
     }
+    }
     if (i != argc)
       putchar(' ');
   }
@@ -39,7 +51,13 @@ Value script_print(Vm *vm, size_t argc, Value argv[]) {
 }
 
 Value script_append(Vm *vm, size_t argc, Value argv[]) {
-  return value_concat(argv[0], argv[1]);
+  // natives have no way to raise a runtime error
+  Value result;
+  if (!value_concat(argv[0], argv[1], &result)) {
+    puts("string too long");
+    exit(-1);
+  }
+  return result;
 }
 
 Value script_tostring(Vm *vm, size_t argc, Value argv[]) {
@@ -53,8 +71,8 @@ Value script_tonumber(Vm *vm, size_t argc, Value argv[]) {
 }
 
 Value script_check_number(Vm *vm, size_t argc, Value argv[]) {
-  if (argv[0].type == ValueType_Number)
-    printf("got number %g\n", argv[0].number);
+  if (value_type(argv[0]) == ValueType_Number)
+    printf("got number %g\n", value_as_number(argv[0]));
   else
     puts("got null!!!");
   return new_null_value();
@@ -66,11 +84,87 @@ Value script_maybe_roll(Vm *vm, size_t argc, Value argv[]) {
   return new_null_value();
 }
 
+static double elapsed_ms(clock_t start) {
+  return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// clock() adds up every thread's cpu time, this is what a stopwatch would say
+static double wall_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+// instruction counts only mean something when the vms were built to keep them
+static void print_vm_run(const char *name, size_t executed, double ms) {
+#ifdef VM_STATS
+  printf("%s: %zu instructions, %.3f ms\n", name, executed, ms);
+#else
+  printf("%s: %.3f ms (instruction counting is off, build with vm_stats)\n",
+         name, ms);
+#endif
+}
+
+// the script's path with its extension, if it has one, swapped for .pbc. a
+// script that's already called .pbc gets it added on so it isn't overwritten
+static char *pbc_path(const char *path) {
+  size_t stem_len = strlen(path);
+  const char *dot = strrchr(path, '.');
+  const char *slash = strrchr(path, '/');
+  if (dot != NULL && (slash == NULL || dot > slash + 1) &&
+      strcmp(dot, ".pbc") != 0)
+    stem_len = dot - path;
+
+  char *pbc_path = malloc(stem_len + sizeof(".pbc"));
+  assert(pbc_path != NULL);
+  memcpy(pbc_path, path, stem_len);
+  memcpy(pbc_path + stem_len, ".pbc", sizeof(".pbc"));
+  return pbc_path;
+}
+
+static void print_heap_stats(const char *name, const Heap *heap) {
+  HeapStats stats = get_heap_stats(heap);
+  printf("%s heap: %zu allocations (%zu large), %zu frees, %zu slabs, "
+         "peak %zu bytes\n",
+         name, stats.allocs, stats.large_allocs, stats.frees, stats.slabs_num,
+         stats.peak_bytes);
+}
+
 int main(int argc, char *argv[]) {
+  // --register runs the register vm instead, --compare runs both,
+  // --heap-stats reports what each vm allocated, --cache keeps the compiled
+  // stack bytecode next to the script in a file with the extension swapped
+  // for .pbc. the script is read from the path given, or stdin without one.
+  // --repeat n runs the stack vm n times, reusing it between runs, spread
+  // over --threads n workers
+  bool use_stack = true, use_register = false, heap_stats = false;
+  bool use_cache = false;
+  size_t repeat = 1, threads_num = 0;
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--register") == 0) {
+      use_stack = false;
+      use_register = true;
+    } else if (strcmp(argv[i], "--compare") == 0) {
+      use_stack = true;
+      use_register = true;
+    } else if (strcmp(argv[i], "--heap-stats") == 0) {
+      heap_stats = true;
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      use_cache = true;
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads_num = strtoul(argv[++i], NULL, 10);
+    } else {
+      path = argv[i];
+    }
+  }
+  bool compare = use_stack && use_register;
+  int status = 0;
+
   srand(time(NULL));
-  char source[1024];
-  size_t len = fread(source, 1, sizeof(source) - 1, stdin);
-  source[len] = 0;
+  Source source = path != NULL ? load_source_file(path) : read_source(stdin);
 
   Registry registry = new_registry();
   register_native_fn(&registry, "void print(...)", script_print);
@@ -81,10 +175,93 @@ int main(int argc, char *argv[]) {
                      script_check_number);
   register_native_fn(&registry, "number? maybe_roll()", script_maybe_roll);
 
-  Chunk chunk = compile_script(source, &registry);
-  disassemble_chunk(&chunk, &registry);
-  Vm vm = new_vm(&chunk, &registry);
-  run_vm(&vm);
+  if (use_stack) {
+    // a stale or broken cache is just compiled over
+    char *cache_path = NULL;
+    if (use_cache && path != NULL)
+      cache_path = pbc_path(path);
+
+    Chunk chunk;
+    if (cache_path == NULL ||
+        !load_pbc(cache_path, source.chars, source.len, &registry, &chunk)) {
+      chunk = compile_script(source.chars, source.len, &registry);
+      if (compare) {
+        printf("peephole: removed %zu instructions, %zu bytes\n",
+               chunk.peephole_instructions, chunk.peephole_bytes);
+      }
+      if (cache_path != NULL)
+        write_pbc(cache_path, &chunk, &registry, source.chars, source.len);
+    }
+    free(cache_path);
+    disassemble_chunk(&chunk, &registry);
+    Vm vm = new_vm(&chunk, &registry);
+    clock_t start = clock();
+    // scripts take no arguments, whatever a cache file claims
+    run_vm_args(&vm, NULL, 0);
+    if (vm.error != NULL) {
+      printf("runtime error: %s\n", vm.error);
+      status = 1;
+    }
+    if (repeat > 1 && threads_num != 0) {
+      // no arguments, so every job looks the same
+      RunnerJob *jobs = calloc(repeat - 1, sizeof(*jobs));
+      assert(jobs != NULL);
+
+      Runner *runner = new_runner(&chunk, &registry, threads_num);
+      double start = wall_ms();
+      Batch batch = run_batch(runner, jobs, repeat - 1);
+      double elapsed = wall_ms() - start;
+      delete_runner(runner);
+      free(jobs);
+
+      BatchStats stats = batch.stats;
+      printf("runner: %zu runs on %zu threads, %.1f ns each, %zu errors, "
+             "%zu steals\n",
+             repeat - 1, threads_num, elapsed * 1e6 / (repeat - 1),
+             stats.errors, stats.steals);
+      printf("runner latency: mean %" PRIu64 " ns, p50 %" PRIu64
+             ", p90 %" PRIu64 ", p99 %" PRIu64 ", p99.9 %" PRIu64
+             ", max %" PRIu64 "\n",
+             stats.mean_ns, stats.p50_ns, stats.p90_ns, stats.p99_ns,
+             stats.p999_ns, stats.max_ns);
+      if (stats.errors != 0)
+        status = 1;
+      delete_batch(&batch);
+    } else if (repeat > 1) {
+      clock_t start = clock();
+      for (size_t i = 1; i < repeat; i++) {
+        reset_vm(&vm);
+        run_vm_args(&vm, NULL, 0);
+      }
+      printf("stack vm: %zu reruns, %.1f ns each\n", repeat - 1,
+             elapsed_ms(start) * 1e6 / (repeat - 1));
+    }
+    if (compare)
+      print_vm_run("stack vm", vm.executed, elapsed_ms(start));
+    if (heap_stats)
+      print_heap_stats("stack vm", vm.heap);
+    delete_vm(&vm);
+  }
+
+  if (use_register) {
+    RegChunk chunk = compile_script_reg(source.chars, source.len, &registry);
+    disassemble_reg_chunk(&chunk, &registry);
+    RegVm vm = new_reg_vm(&chunk, &registry);
+    clock_t start = clock();
+    run_reg_vm(&vm);
+    if (vm.error != NULL) {
+      printf("runtime error: %s\n", vm.error);
+      status = 1;
+    }
+    if (compare)
+      print_vm_run("register vm", vm.executed, elapsed_ms(start));
+    if (heap_stats)
+      print_heap_stats("register vm", vm.heap);
+    delete_reg_vm(&vm);
+  }
+
   printf("alive values: %u\n", get_active_values());
-  return 0;
+  free_interned_strings();
+  delete_source(&source);
+  return status;
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "optimizer.h"
+#include "expr.h"
+#include "lexer.h"
+#include "utility.h"
+#include "value.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static void set_assigned_name(Optimizer *optimizer, const char *name,
+                              size_t name_len) {
+  uint32_t bit = hash_string(name, name_len) % ASSIGNED_NAME_BITS;
+  optimizer->assigned_names[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+bool is_name_assigned(const Optimizer *optimizer, const char *name,
+                      size_t name_len) {
+  uint32_t bit = hash_string(name, name_len) % ASSIGNED_NAME_BITS;
+  return (optimizer->assigned_names[bit / 64] >> (bit % 64)) & 1;
+}
+
+Optimizer new_optimizer(const char *source, size_t len) {
+  Optimizer optimizer = {
+      .assigned_names = {},
+
+      .facts = NULL,
+      .facts_cap = 0,
+  };
+
+  // an assignment is a name followed by '=', possibly with some parentheses
+  // in between, that isn't being declared by a let
+  Lexer lexer = new_lexer(source, len);
+  Token name = {0};
+  bool pending = false;
+  TokenType before = TokenType_Eof;
+  for (Token token = lexer_peek(&lexer); token.type != TokenType_Eof;
+       token = lexer_advance(&lexer)) {
+    if (token.type == TokenType_Identifier) {
+      name = token;
+      pending = (before != TokenType_Let);
+    } else if (token.type == TokenType_Assign) {
+      if (pending)
+        set_assigned_name(&optimizer, name.text.start, name.text.len);
+      pending = false;
+    } else if (token.type != TokenType_RParen) {
+      pending = false;
+    }
+    before = token.type;
+  }
+  delete_lexer(&lexer);
+
+  return optimizer;
+}
+
+void delete_optimizer(Optimizer *optimizer) { free(optimizer->facts); }
+
+void declare_optimizer_var(Optimizer *optimizer, size_t idx, bool immutable) {
+  if (idx >= optimizer->facts_cap) {
+    size_t cap = (optimizer->facts_cap == 0) ? 64 : optimizer->facts_cap * 2;
+    while (cap <= idx)
+      cap *= 2;
+    optimizer->facts =
+        realloc(optimizer->facts, cap * sizeof(*optimizer->facts));
+    assert(optimizer->facts != NULL);
+    optimizer->facts_cap = cap;
+  }
+
+  optimizer->facts[idx] = (VarFact){
+      .type = VarFactType_Unknown,
+      .immutable = immutable,
+  };
+}
+
+void init_optimizer_var(Optimizer *optimizer, size_t idx, const Expr *value) {
+  assert(idx < optimizer->facts_cap);
+  VarFact *fact = &optimizer->facts[idx];
+  if (!fact->immutable)
+    return;
+
+  if (value->type == ExprType_Literal) {
+    fact->type = VarFactType_Literal;
+    fact->literal = value->literal;
+  } else if (value->type == ExprType_GetVar &&
+             optimizer->facts[value->get_var.idx].immutable) {
+    // the other one can't change either, so they're interchangeable
+    fact->type = VarFactType_Copy;
+    fact->copy_of = value->get_var.idx;
+  }
+}
+
+void optimize_expr(const Optimizer *optimizer, Expr *expr) {
+  switch (expr->type) {
+  case ExprType_Literal:
+    break;
+  case ExprType_GetVar: {
+    assert(expr->get_var.idx < optimizer->facts_cap);
+    const VarFact *fact = &optimizer->facts[expr->get_var.idx];
+    if (fact->type == VarFactType_Literal) {
+      expr->type = ExprType_Literal;
+      expr->literal = fact->literal;
+    } else if (fact->type == VarFactType_Copy) {
+      // copies are made from what the other one was optimized into, so
+      // there's never a chain to follow
+      expr->get_var.idx = fact->copy_of;
+    }
+    break;
+  }
+  case ExprType_SetVar:
+    optimize_expr(optimizer, expr->set_var.value);
+    break;
+
+  case ExprType_NativeCall:
+    for (Expr *arg = expr->call.argv_head; arg != NULL; arg = arg->next)
+      optimize_expr(optimizer, arg);
+    break;
+
+  case ExprType_Unary:
+    optimize_expr(optimizer, expr->unary.operand);
+    break;
+  case ExprType_Binary:
+    optimize_expr(optimizer, expr->binary.lhs);
+    optimize_expr(optimizer, expr->binary.rhs);
+    break;
+  }
+  fold_expr(expr);
+}
@@ -1,8 +1,13 @@
 #include "parser.h"
+#include "arena.h"
 #include "bytecode.h"
 #include "chunk.h"
 #include "expr.h"
+#include "intern.h"
 #include "lexer.h"
+#include "optimizer.h"
+#include "reg_bytecode.h"
+#include "reg_chunk.h"
 #include "registry.h"
 #include "type_def.h"
 #include "utility.h"
@@ -10,12 +15,16 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-enum { MAX_VARS = 128 };
+// slots past UINT8_MAX use the wide load/store forms, and the register vm
+// needs UINT16_MAX itself for REG_NONE
+enum { MAX_VARS = UINT16_MAX };
 enum { MAX_LOOP_HOLES = 32 };
+enum { VAR_BUCKETS = 256 };
 
 typedef enum Symbol {
   Symbol_None = 0,
@@ -23,8 +32,18 @@ typedef enum Symbol {
   Symbol_NativeFn,
 } Symbol;
 
+typedef enum Backend {
+  Backend_Stack = 0,
+  Backend_Register,
+} Backend;
+
 typedef struct Var {
-  char *name;
+  char *name; // lives in Parser::names
+  size_t name_len;
+  uint32_t name_hash;
+  // the next older var in the same bucket + 1, 0 ends the chain
+  uint32_t bucket_next;
+
   TypeDef type;
   size_t block_depth;
 } Var;
@@ -42,12 +61,27 @@ typedef struct LoopState {
 typedef struct Parser {
   Lexer lexer;
   const Registry *registry;
+  Backend backend;
 
   size_t block_level;
-  Var vars[MAX_VARS];
-  size_t vars_num;
+  Var *vars;
+  size_t vars_num, vars_cap;
+  // chains of live vars by name hash, newest first, holding the var index + 1.
+  // vars go away in the opposite order they're made in, so the one being
+  // popped is always at the head of its chain
+  uint32_t var_buckets[VAR_BUCKETS];
 
   Chunk chunk;
+  RegChunk reg_chunk;
+
+  Optimizer optimizer;
+  // set after a return, break or continue until the end of the block
+  bool unreachable;
+
+  // exprs are thrown away after every top-level statement, names last for
+  // the whole compile
+  Arena exprs;
+  Arena names;
 } Parser;
 
 static Token peek(const Parser *parser) { return lexer_peek(&parser->lexer); }
@@ -82,24 +116,21 @@ static Token expect(Parser *parser, TokenType what, const char *error_msg) {
 
 static Symbol lookup_symbol(const Parser *parser, const char *name,
                             size_t name_len, size_t *out_idx) {
-  for (size_t i = parser->vars_num - 1; i < MAX_VARS; i--) {
-    const Var *var = &parser->vars[i];
-    if (compare_string(name, name_len, var->name, strlen(var->name))) {
+  uint32_t hash = hash_string(name, name_len);
+  uint32_t next = parser->var_buckets[hash % VAR_BUCKETS];
+  while (next != 0) {
+    const Var *var = &parser->vars[next - 1];
+    if (var->name_hash == hash &&
+        compare_string(name, name_len, var->name, var->name_len)) {
       if (out_idx != NULL)
-        *out_idx = i;
+        *out_idx = next - 1;
       return Symbol_Var;
     }
+    next = var->bucket_next;
   }
 
-  for (size_t i = 0; i < parser->registry->native_fns_num; i++) {
-    const NativeFn *fn = &parser->registry->native_fns[i];
-    if (compare_string(name, name_len, fn->name, strlen(fn->name))) {
-      if (out_idx != NULL)
-        *out_idx = i;
-      return Symbol_NativeFn;
-    }
-  }
-
+  if (find_native_fn(parser->registry, name, name_len, out_idx) != NULL)
+    return Symbol_NativeFn;
   return Symbol_None;
 }
 
@@ -114,17 +145,31 @@ static size_t new_var(Parser *parser, const char *name, size_t name_len,
     exit(-1);
   }
 
-  char *name_copy = strndup(name, name_len);
-  assert(name_copy != NULL);
+  if (parser->vars_num == parser->vars_cap) {
+    parser->vars_cap = (parser->vars_cap == 0) ? 64 : parser->vars_cap * 2;
+    parser->vars =
+        realloc(parser->vars, parser->vars_cap * sizeof(*parser->vars));
+    assert(parser->vars != NULL);
+  }
+
+  uint32_t hash = hash_string(name, name_len);
+  uint32_t *bucket = &parser->var_buckets[hash % VAR_BUCKETS];
   parser->vars[parser->vars_num] = (Var){
-      .name = name_copy,
+      .name = arena_strndup(&parser->names, name, name_len),
+      .name_len = name_len,
+      .name_hash = hash,
+      .bucket_next = *bucket,
+
       .type = type,
       .block_depth = parser->block_level,
   };
   parser->vars_num++;
+  *bucket = parser->vars_num;
   if (loop_state != NULL)
     loop_state->vars_num++;
 
+  declare_optimizer_var(&parser->optimizer, parser->vars_num - 1,
+                        !is_name_assigned(&parser->optimizer, name, name_len));
   return parser->vars_num - 1;
 }
 
@@ -136,10 +181,87 @@ static void pop_var(Parser *parser, LoopState *loop_state) {
     loop_state->vars_num--;
   }
   parser->vars_num--;
-  free(parser->vars[parser->vars_num].name);
+  const Var *var = &parser->vars[parser->vars_num];
+  uint32_t *bucket = &parser->var_buckets[var->name_hash % VAR_BUCKETS];
+  assert(*bucket == parser->vars_num + 1);
+  *bucket = var->bucket_next;
+
+  // make sure to pop it off the stack as well, registers simply get reused
+  if (parser->backend == Backend_Stack)
+    write_chunk_u8(&parser->chunk, Bytecode_Pop);
+}
 
-  // make sure to pop it off the stack as well
-  write_chunk_u8(&parser->chunk, Bytecode_Pop);
+// where the next instruction is going to be written, for jumps to land on
+static size_t code_pos(const Parser *parser) {
+  if (parser->backend == Backend_Register)
+    return parser->reg_chunk.size;
+  return parser->chunk.size;
+}
+
+// writes a jump with its target left open
+static size_t write_jump(Parser *parser) {
+  if (parser->backend == Backend_Register) {
+    return write_reg_chunk(&parser->reg_chunk, (RegInstruction){
+                                                   .op = RegBytecode_Jump,
+                                               });
+  }
+
+  write_chunk_u8(&parser->chunk, Bytecode_Jump);
+  return write_chunk_hole(&parser->chunk, 16);
+}
+
+// points a jump written by write_jump at the current position
+static void patch_jump(Parser *parser, size_t hole) {
+  if (parser->backend == Backend_Register)
+    patch_reg_chunk_jump(&parser->reg_chunk, hole);
+  else
+    patch_chunk_hole_u16(&parser->chunk, hole);
+}
+
+// code that can never run is still parsed and type checked, whatever it wrote
+// just gets thrown away again
+typedef struct DeadCode {
+  size_t pos;
+  size_t start_holes_num, end_holes_num;
+  bool unreachable;
+} DeadCode;
+
+static DeadCode begin_dead_code(const Parser *parser,
+                                const LoopState *loop_state) {
+  return (DeadCode){
+      .pos = code_pos(parser),
+      .start_holes_num = (loop_state != NULL) ? loop_state->start_holes_num : 0,
+      .end_holes_num = (loop_state != NULL) ? loop_state->end_holes_num : 0,
+      .unreachable = parser->unreachable,
+  };
+}
+
+static void end_dead_code(Parser *parser, const DeadCode *dead,
+                          LoopState *loop_state) {
+  if (parser->backend == Backend_Register)
+    truncate_reg_chunk(&parser->reg_chunk, dead->pos);
+  else
+    truncate_chunk(&parser->chunk, dead->pos);
+
+  // any break or continue in there is gone as well
+  if (loop_state != NULL) {
+    loop_state->start_holes_num = dead->start_holes_num;
+    loop_state->end_holes_num = dead->end_holes_num;
+  }
+  parser->unreachable = dead->unreachable;
+}
+
+static void write_jump_back(Parser *parser, size_t target) {
+  if (parser->backend == Backend_Register) {
+    write_reg_chunk(&parser->reg_chunk, (RegInstruction){
+                                            .op = RegBytecode_Jump,
+                                            .b = target,
+                                        });
+    return;
+  }
+
+  write_chunk_u8(&parser->chunk, Bytecode_JumpBack);
+  write_chunk_back_offset_u16(&parser->chunk, target);
 }
 
 static Expr *expr_base(Parser *parser);
@@ -185,7 +307,7 @@ static Expr *call(Parser *parser, size_t idx, bool native) {
     exit(-1);
   }
 
-  return new_native_call_expr(idx, fn->return_type, argv_head);
+  return new_native_call_expr(&parser->exprs, idx, fn->return_type, argv_head);
 }
 
 static Expr *primary(Parser *parser) {
@@ -193,20 +315,21 @@ static Expr *primary(Parser *parser) {
   switch (token.type) {
   case TokenType_Null:
     advance(parser);
-    return new_literal_expr(new_null_value());
+    return new_literal_expr(&parser->exprs, new_null_value());
   case TokenType_True:
     advance(parser);
-    return new_literal_expr(new_boolean_value(true));
+    return new_literal_expr(&parser->exprs, new_boolean_value(true));
   case TokenType_False:
     advance(parser);
-    return new_literal_expr(new_boolean_value(false));
+    return new_literal_expr(&parser->exprs, new_boolean_value(false));
 
   case TokenType_Number:
     advance(parser);
-    return new_literal_expr(new_number_value(token.number));
+    return new_literal_expr(&parser->exprs, new_number_value(token.number));
   case TokenType_String:
     advance(parser);
-    return new_literal_expr(new_string_value(token.text.start, token.text.len));
+    return new_literal_expr(&parser->exprs,
+                            intern_string(token.text.start, token.text.len));
   case TokenType_Identifier: {
     advance(parser);
     size_t sym_idx;
@@ -229,7 +352,8 @@ static Expr *primary(Parser *parser) {
     // TODO: function references?
     assert(sym == Symbol_Var);
 
-    return new_get_var_expr(sym_idx, parser->vars[sym_idx].type);
+    return new_get_var_expr(&parser->exprs, sym_idx,
+                            parser->vars[sym_idx].type);
   }
 
   case TokenType_LParen: {
@@ -252,7 +376,7 @@ static Expr *prefix(Parser *parser) {
       exit(-1);
     }
 
-    return new_unary_expr(UnaryOp_Negate, operand);
+    return new_unary_expr(&parser->exprs, UnaryOp_Negate, operand);
   } else if (match(parser, TokenType_Bang)) {
     Expr *operand = primary(parser);
     if (!is_type_def_boolean(operand->return_type)) {
@@ -260,7 +384,7 @@ static Expr *prefix(Parser *parser) {
       exit(-1);
     }
 
-    return new_unary_expr(UnaryOp_Not, operand);
+    return new_unary_expr(&parser->exprs, UnaryOp_Not, operand);
   }
 
   return primary(parser);
@@ -298,7 +422,7 @@ static bool check_booleans(BinaryOp op, TypeDef lhs, TypeDef rhs) {
         exit(-1);                                                              \
       }                                                                        \
                                                                                \
-      lhs = new_binary_expr(token_to_binary_op(token.type), lhs, rhs);         \
+      lhs = new_binary_expr(&parser->exprs, op, lhs, rhs);                     \
       token = peek(parser);                                                    \
     }                                                                          \
                                                                                \
@@ -336,10 +460,46 @@ static Expr *expr_base(Parser *parser) {
   return expr;
 }
 
-static void finalize_expr(Parser *parser, Expr *expr) {
-  // simplify_expr(expr);
-  compile_expr(&parser->chunk, expr);
-  delete_expr(expr);
+static void optimize(const Parser *parser, Expr *expr) {
+  optimize_expr(&parser->optimizer, expr);
+}
+
+static void write_expr(Parser *parser, const Expr *expr, size_t dest) {
+  if (parser->backend == Backend_Register) {
+    size_t temp = parser->vars_num;
+    if (dest != REG_NONE && dest >= temp)
+      temp = dest + 1;
+    compile_reg_expr(&parser->reg_chunk, expr, dest, temp);
+  } else {
+    compile_expr(&parser->chunk, expr);
+  }
+}
+
+// the stack backend leaves the result on top of the stack, the register one
+// puts it into dest (which might be REG_NONE)
+static void finalize_expr(Parser *parser, Expr *expr, size_t dest) {
+  optimize(parser, expr);
+  write_expr(parser, expr, dest);
+}
+
+// compiles the already optimized condition along with a jump taken when it's
+// false, returns the jump's hole
+static size_t finalize_condition(Parser *parser, const Expr *cond) {
+  if (parser->backend == Backend_Stack) {
+    return compile_jump_if_false(&parser->chunk, cond);
+  }
+
+  size_t cond_reg = parser->vars_num;
+  if (cond->type == ExprType_GetVar) {
+    cond_reg = cond->get_var.idx;
+  } else {
+    write_expr(parser, cond, cond_reg);
+  }
+
+  return write_reg_chunk(&parser->reg_chunk, (RegInstruction){
+                                                 .op = RegBytecode_JumpIfFalse,
+                                                 .a = cond_reg,
+                                             });
 }
 
 static void statement(Parser *parser, LoopState *loop_state);
@@ -358,6 +518,21 @@ static void block(Parser *parser, LoopState *loop_state) {
     pop_var(parser, loop_state);
   }
   parser->block_level--;
+  // jumps around the block can still land after it
+  parser->unreachable = false;
+}
+
+// a block that can't ever run only gets parsed
+static void maybe_dead_block(Parser *parser, LoopState *loop_state,
+                             bool dead) {
+  if (!dead) {
+    block(parser, loop_state);
+    return;
+  }
+
+  DeadCode dead_code = begin_dead_code(parser, loop_state);
+  block(parser, loop_state);
+  end_dead_code(parser, &dead_code, loop_state);
 }
 
 static void if_statement(Parser *parser, LoopState *loop_state) {
@@ -366,27 +541,37 @@ static void if_statement(Parser *parser, LoopState *loop_state) {
     puts("if condition must be a boolean");
     exit(-1);
   }
-  finalize_expr(parser, cond);
+
+  optimize(parser, cond);
+  if (cond->type == ExprType_Literal) {
+    // only the branch that's taken needs any code, or jumps
+    bool taken = value_as_boolean(cond->literal);
+    expect(parser, TokenType_LBrace, "expected '{' after if condition");
+    maybe_dead_block(parser, loop_state, !taken);
+    if (match(parser, TokenType_Else)) {
+      expect(parser, TokenType_LBrace, "expected '{' after 'else'");
+      maybe_dead_block(parser, loop_state, taken);
+    }
+    return;
+  }
 
   // skip over the true body if the condition is false
-  write_chunk_u8(&parser->chunk, Bytecode_JumpIfFalse);
-  size_t skip_true_hole = write_chunk_hole(&parser->chunk, 16);
+  size_t skip_true_hole = finalize_condition(parser, cond);
 
   expect(parser, TokenType_LBrace, "expected '{' after if condition");
   block(parser, loop_state);
 
   if (match(parser, TokenType_Else)) {
     // make sure to skip over the false body if the condition is true
-    write_chunk_u8(&parser->chunk, Bytecode_Jump);
-    size_t skip_false_hole = write_chunk_hole(&parser->chunk, 16);
-    patch_chunk_hole_u16(&parser->chunk, skip_true_hole);
+    size_t skip_false_hole = write_jump(parser);
+    patch_jump(parser, skip_true_hole);
 
     expect(parser, TokenType_LBrace, "expected '{' after 'else'");
     block(parser, loop_state);
 
-    patch_chunk_hole_u16(&parser->chunk, skip_false_hole);
+    patch_jump(parser, skip_false_hole);
   } else {
-    patch_chunk_hole_u16(&parser->chunk, skip_true_hole);
+    patch_jump(parser, skip_true_hole);
   }
 }
 
@@ -397,11 +582,18 @@ static void while_statement(Parser *parser) {
     exit(-1);
   }
 
-  size_t cond_pos = parser->chunk.size;
-  finalize_expr(parser, cond);
+  // a constant condition means the loop is never entered, or only ever left
+  // through a break
+  optimize(parser, cond);
+  bool constant = (cond->type == ExprType_Literal);
+  bool never = constant && !value_as_boolean(cond->literal);
+  DeadCode dead = begin_dead_code(parser, NULL);
+
+  size_t cond_pos = code_pos(parser);
   // skip over the body if the condition is false
-  write_chunk_u8(&parser->chunk, Bytecode_JumpIfFalse);
-  size_t skip_body_hole = write_chunk_hole(&parser->chunk, 16);
+  size_t skip_body_hole = 0;
+  if (!constant)
+    skip_body_hole = finalize_condition(parser, cond);
 
   LoopState loop_state = {0};
   expect(parser, TokenType_LBrace, "expected '{' after while condition");
@@ -409,15 +601,17 @@ static void while_statement(Parser *parser) {
 
   // back to the condition
   for (size_t i = 0; i < loop_state.start_holes_num; i++)
-    patch_chunk_hole_u16(&parser->chunk, loop_state.start_holes[i]);
+    patch_jump(parser, loop_state.start_holes[i]);
 
-  write_chunk_u8(&parser->chunk, Bytecode_JumpBack);
-  write_chunk_u16(&parser->chunk,
-                  parser->chunk.size - cond_pos + sizeof(uint16_t));
+  write_jump_back(parser, cond_pos);
 
-  patch_chunk_hole_u16(&parser->chunk, skip_body_hole);
+  if (!constant)
+    patch_jump(parser, skip_body_hole);
   for (size_t i = 0; i < loop_state.end_holes_num; i++)
-    patch_chunk_hole_u16(&parser->chunk, loop_state.end_holes[i]);
+    patch_jump(parser, loop_state.end_holes[i]);
+
+  if (never)
+    end_dead_code(parser, &dead, NULL);
 }
 
 static void for_statement(Parser *parser) {
@@ -464,7 +658,6 @@ static void for_statement(Parser *parser) {
     }
 
     step = value_as_number(step_expr->literal);
-    delete_expr(step_expr);
   } else if (from->type == ExprType_Literal && to->type == ExprType_Literal) {
     // const range, check if we're going backwards
     if (value_as_number(from->literal) > value_as_number(to->literal))
@@ -475,25 +668,25 @@ static void for_statement(Parser *parser) {
 
   size_t counter_idx = new_var(parser, counter_token.text.start,
                                counter_token.text.len, TypeDef_Number, NULL);
+  // the loop steps it without a visible assignment
+  declare_optimizer_var(&parser->optimizer, counter_idx, false);
 
   // init
-  finalize_expr(parser, from);
-
-  // condition
-  size_t cond_pos = parser->chunk.size;
-  write_chunk_u8(&parser->chunk, Bytecode_Copy);
-  finalize_expr(parser, to);
-
-  if (step >= 0.0) {
-    write_chunk_u8(&parser->chunk,
-                   (inclusive) ? Bytecode_LessEqual : Bytecode_Less);
-  } else {
-    write_chunk_u8(&parser->chunk,
-                   (inclusive) ? Bytecode_GreaterEqual : Bytecode_Greater);
-  }
-
-  write_chunk_u8(&parser->chunk, Bytecode_JumpIfFalse);
-  size_t skip_body_hole = write_chunk_hole(&parser->chunk, 16);
+  finalize_expr(parser, from, counter_idx);
+
+  // condition, skipping over the body once the counter is past the end
+  BinaryOp cond_op;
+  if (step >= 0.0)
+    cond_op = (inclusive) ? BinaryOp_LessEqual : BinaryOp_Less;
+  else
+    cond_op = (inclusive) ? BinaryOp_GreaterEqual : BinaryOp_Greater;
+
+  size_t cond_pos = code_pos(parser);
+  Expr *counter =
+      new_get_var_expr(&parser->exprs, counter_idx, TypeDef_Number);
+  Expr *cond = new_binary_expr(&parser->exprs, cond_op, counter, to);
+  optimize(parser, cond);
+  size_t skip_body_hole = finalize_condition(parser, cond);
 
   // body
   LoopState loop_state = {0};
@@ -502,24 +695,33 @@ static void for_statement(Parser *parser) {
 
   // increment
   for (size_t i = 0; i < loop_state.start_holes_num; i++)
-    patch_chunk_hole_u16(&parser->chunk, loop_state.start_holes[i]);
-
-  write_chunk_u8(&parser->chunk, Bytecode_Load);
-  write_chunk_u8(&parser->chunk, counter_idx);
-  write_chunk_u8(&parser->chunk, Bytecode_PushNumber);
-  write_chunk_f64(&parser->chunk, step);
-  write_chunk_u8(&parser->chunk, Bytecode_Add);
-  write_chunk_u8(&parser->chunk, Bytecode_Store);
-  write_chunk_u8(&parser->chunk, counter_idx);
-  write_chunk_u8(&parser->chunk, Bytecode_Pop);
-  // back to the condition
-  write_chunk_u8(&parser->chunk, Bytecode_JumpBack);
-  write_chunk_u16(&parser->chunk,
-                  parser->chunk.size - cond_pos + sizeof(uint16_t));
+    patch_jump(parser, loop_state.start_holes[i]);
+
+  // ..and back to the condition, the fused instruction only has room for a
+  // u8 slot
+  if (parser->backend == Backend_Stack && counter_idx <= UINT8_MAX) {
+    write_chunk_u8(&parser->chunk, Bytecode_IncLocalAndLoop);
+    write_chunk_u8(&parser->chunk, counter_idx);
+    write_chunk_f64(&parser->chunk, step);
+    write_chunk_back_offset_u16(&parser->chunk, cond_pos);
+  } else {
+    Expr *counter =
+        new_get_var_expr(&parser->exprs, counter_idx, TypeDef_Number);
+    Expr *step_expr =
+        new_literal_expr(&parser->exprs, new_number_value(step));
+    Expr *sum =
+        new_binary_expr(&parser->exprs, BinaryOp_Add, counter, step_expr);
+    Expr *inc = new_set_var_expr(&parser->exprs, counter_idx, sum);
+    if (parser->backend == Backend_Register)
+      finalize_expr(parser, inc, REG_NONE);
+    else
+      compile_discarded_expr(&parser->chunk, inc);
+    write_jump_back(parser, cond_pos);
+  }
 
-  patch_chunk_hole_u16(&parser->chunk, skip_body_hole);
+  patch_jump(parser, skip_body_hole);
   for (size_t i = 0; i < loop_state.end_holes_num; i++)
-    patch_chunk_hole_u16(&parser->chunk, loop_state.end_holes[i]);
+    patch_jump(parser, loop_state.end_holes[i]);
 
   // ..and make sure to get rid of the counter variable
   pop_var(parser, NULL);
@@ -536,13 +738,15 @@ static void for_statement(Parser *parser) {
       exit(-1);                                                                \
     }                                                                          \
                                                                                \
-    for (size_t i = 0; i < loop_state->vars_num; i++)                          \
-      write_chunk_u8(&parser->chunk, Bytecode_Pop);                            \
+    if (parser->backend == Backend_Stack) {                                    \
+      for (size_t i = 0; i < loop_state->vars_num; i++)                        \
+        write_chunk_u8(&parser->chunk, Bytecode_Pop);                          \
+    }                                                                          \
                                                                                \
-    write_chunk_u8(&parser->chunk, Bytecode_Jump);                             \
-    size_t hole = write_chunk_hole(&parser->chunk, 16);                        \
+    size_t hole = write_jump(parser);                                          \
     loop_state->field_prefix##_holes[loop_state->field_prefix##_holes_num++] = \
         hole;                                                                  \
+    parser->unreachable = true;                                                \
                                                                                \
     expect(parser, TokenType_Semicolon, "expected ';' after '" #name "'");     \
   }
@@ -561,15 +765,45 @@ static void var_decl(Parser *parser, LoopState *loop_state) {
     exit(-1);
   }
 
-  new_var(parser, name_token.text.start, name_token.text.len,
-          value->return_type, loop_state);
-  finalize_expr(parser, value);
+  size_t idx = new_var(parser, name_token.text.start, name_token.text.len,
+                       value->return_type, loop_state);
+  finalize_expr(parser, value, idx);
+  init_optimizer_var(&parser->optimizer, idx, value);
 
   expect(parser, TokenType_Semicolon,
          "expected ';' after variable declaration");
 }
 
-static void statement(Parser *parser, LoopState *loop_state) {
+static void return_statement(Parser *parser) {
+  Expr *value;
+  if (peek(parser).type == TokenType_Semicolon) {
+    value = new_literal_expr(&parser->exprs, new_null_value());
+  } else {
+    value = expr_base(parser);
+    if (is_type_def_void(value->return_type)) {
+      puts("void expression can't be returned");
+      exit(-1);
+    }
+  }
+
+  // the stack backend leaves the result on top, the register one needs
+  // somewhere to put it
+  size_t result_reg = parser->vars_num;
+  finalize_expr(parser, value, result_reg);
+  if (parser->backend == Backend_Stack) {
+    write_chunk_u8(&parser->chunk, Bytecode_Return);
+  } else {
+    write_reg_chunk(&parser->reg_chunk, (RegInstruction){
+                                            .op = RegBytecode_Return,
+                                            .a = result_reg,
+                                        });
+  }
+  parser->unreachable = true;
+
+  expect(parser, TokenType_Semicolon, "expected ';' after return");
+}
+
+static void any_statement(Parser *parser, LoopState *loop_state) {
   if (match(parser, TokenType_If)) {
     if_statement(parser, loop_state);
   } else if (match(parser, TokenType_While)) {
@@ -580,6 +814,8 @@ static void statement(Parser *parser, LoopState *loop_state) {
     break_statement(parser, loop_state);
   } else if (match(parser, TokenType_Continue)) {
     continue_statement(parser, loop_state);
+  } else if (match(parser, TokenType_Return)) {
+    return_statement(parser);
   } else if (match(parser, TokenType_Let)) {
     var_decl(parser, loop_state);
   } else if (match(parser, TokenType_LBrace)) {
@@ -587,28 +823,120 @@ static void statement(Parser *parser, LoopState *loop_state) {
   } else {
     // expression
     Expr *expr = expr_base(parser);
-    bool has_value = !is_type_def_void(expr->return_type);
-    finalize_expr(parser, expr);
+    if (parser->backend == Backend_Stack) {
+      optimize(parser, expr);
+      compile_discarded_expr(&parser->chunk, expr);
+    } else {
+      finalize_expr(parser, expr, REG_NONE);
+    }
     expect(parser, TokenType_Semicolon, "expected ';' after expression");
+  }
+}
 
-    if (has_value)
-      write_chunk_u8(&parser->chunk, Bytecode_Pop);
+static void statement(Parser *parser, LoopState *loop_state) {
+  if (!parser->unreachable) {
+    any_statement(parser, loop_state);
+    return;
   }
+
+  // nothing after a return, break or continue in the same block can run
+  DeadCode dead = begin_dead_code(parser, loop_state);
+  any_statement(parser, loop_state);
+  end_dead_code(parser, &dead, loop_state);
 }
 
-Chunk compile_script(const char *source, const Registry *registry) {
-  Parser parser = {
-      .lexer = new_lexer(source),
+static Parser new_parser(const char *source, size_t len,
+                         const Registry *registry, Backend backend) {
+  return (Parser){
+      .lexer = new_buffered_lexer(source, len),
       .registry = registry,
+      .backend = backend,
 
       .block_level = 0,
-      .vars = {},
+      .vars = NULL,
       .vars_num = 0,
+      .vars_cap = 0,
+      .var_buckets = {},
 
       .chunk = new_chunk(),
+      .reg_chunk = new_reg_chunk(),
+
+      .optimizer = new_optimizer(source, len),
+      .unreachable = false,
+
+      .exprs = new_arena(),
+      .names = new_arena(),
   };
+}
 
+static void top_level_statement(Parser *parser) {
+  statement(parser, NULL);
+  reset_arena(&parser->exprs);
+}
+
+static void delete_parser(Parser *parser) {
+  delete_lexer(&parser->lexer);
+  free(parser->vars);
+  delete_optimizer(&parser->optimizer);
+  delete_arena(&parser->exprs);
+  delete_arena(&parser->names);
+}
+
+// args look like the argument list of a native fn signature, each with a
+// name: "number count, string name"
+static void declare_args(Parser *parser, const char *args) {
+  Lexer lexer = new_lexer(args, strlen(args));
+  while (lexer_peek(&lexer).type != TokenType_Eof) {
+    if (parser->chunk.args_num != 0) {
+      if (lexer_peek(&lexer).type != TokenType_Comma)
+        assert(0 && "expected ',' after argument");
+      lexer_advance(&lexer);
+    }
+
+    TypeDef type = parse_type_def(&lexer);
+    if (type.value == ValueType_Error || type.value == ValueType_Void)
+      assert(0 && "bad argument type");
+
+    Token name_token = lexer_peek(&lexer);
+    if (name_token.type != TokenType_Identifier)
+      assert(0 && "expected identifier after argument type");
+    lexer_advance(&lexer);
+    new_var(parser, name_token.text.start, name_token.text.len, type, NULL);
+
+    Chunk *chunk = &parser->chunk;
+    size_t arg_types_size = (chunk->args_num + 1) * sizeof(*chunk->arg_types);
+    chunk->arg_types = realloc(chunk->arg_types, arg_types_size);
+    assert(chunk->arg_types != NULL);
+    chunk->arg_types[chunk->args_num++] = type;
+  }
+  delete_lexer(&lexer);
+}
+
+Chunk compile_script(const char *source, size_t len, const Registry *registry) {
+  return compile_script_args(source, len, registry, "");
+}
+
+Chunk compile_script_args(const char *source, size_t len,
+                          const Registry *registry, const char *args) {
+  Parser parser = new_parser(source, len, registry, Backend_Stack);
+  declare_args(&parser, args);
   while (!is_eof(&parser))
-    statement(&parser, NULL);
+    top_level_statement(&parser);
+  delete_parser(&parser);
+  relax_chunk(&parser.chunk);
+  peephole_chunk(&parser.chunk);
   return parser.chunk;
+}
+
+RegChunk compile_script_reg(const char *source, size_t len,
+                            const Registry *registry) {
+  Parser parser = new_parser(source, len, registry, Backend_Register);
+  while (!is_eof(&parser))
+    top_level_statement(&parser);
+  delete_parser(&parser);
+
+  write_reg_chunk(&parser.reg_chunk, (RegInstruction){
+                                         .op = RegBytecode_Halt,
+                                     });
+  return parser.reg_chunk;
 }
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "pbc.h"
+#include "bytecode.h"
+#include "chunk.h"
+#include "registry.h"
+#include "type_def.h"
+#include "utility.h"
+#include "value.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the file is this header followed by the strings, each a u32 length and its
+// characters, then the natives the code calls, each its index in the code
+// plus the length-prefixed name and signature, then a value type byte and an
+// optional byte for each argument, and finally the code itself.
+// numbers are written in the byte order of the machine that wrote the file
+typedef struct PbcHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t strings_num;
+  uint32_t natives_num;
+  uint32_t code_size;
+  uint32_t args_num;
+  uint32_t pad;
+  uint64_t source_len;
+  uint64_t source_hash;
+  uint64_t payload_hash; // everything after the header
+} PbcHeader;
+
+static const char PBC_MAGIC[4] = {'P', 'B', 'C', 0};
+enum { PBC_BYTE_ORDER = 0x01020304 };
+
+static void write_bytes(Chunk *out, const void *bytes, size_t len) {
+  const uint8_t *data = bytes;
+  for (size_t i = 0; i < len; i++)
+    write_chunk_u8(out, data[i]);
+}
+
+static void write_text(Chunk *out, const char *chars, size_t len) {
+  write_chunk_u32(out, len);
+  write_bytes(out, chars, len);
+}
+
+bool write_pbc(const char *path, const Chunk *chunk, const Registry *registry,
+               const char *source, size_t source_len) {
+  // only the natives the code actually calls are saved
+  bool *called = calloc(registry->native_fns_num + 1, sizeof(*called));
+  assert(called != NULL);
+  uint32_t natives_num = 0;
+  for (size_t pos = 0; pos < chunk->size;) {
+    size_t operand_pos = pos + 1;
+    pos += bytecode_size(chunk->code[pos]);
+    if (chunk->code[operand_pos - 1] != Bytecode_NativeCall)
+      continue;
+
+    uint16_t idx = read_chunk_u16(chunk, &operand_pos);
+    assert(idx < registry->native_fns_num);
+    if (!called[idx])
+      natives_num++;
+    called[idx] = true;
+  }
+
+  // the payload is put together in memory, a chunk makes a handy byte buffer
+  Chunk payload = new_chunk();
+  for (size_t i = 0; i < chunk->strings_num; i++) {
+    ObjString *string = value_as_string(chunk->strings[i]);
+    write_text(&payload, string_chars(string), string->len);
+  }
+  for (size_t i = 0; i < registry->native_fns_num; i++) {
+    if (!called[i])
+      continue;
+
+    const NativeFn *fn = &registry->native_fns[i];
+    write_chunk_u32(&payload, i);
+    write_text(&payload, fn->name, fn->name_len);
+    write_text(&payload, fn->signature, strlen(fn->signature));
+  }
+  for (size_t i = 0; i < chunk->args_num; i++) {
+    write_chunk_u8(&payload, chunk->arg_types[i].value);
+    write_chunk_u8(&payload, chunk->arg_types[i].optional);
+  }
+  write_bytes(&payload, chunk->code, chunk->size);
+  free(called);
+
+  PbcHeader header = {
+      .version = PBC_VERSION,
+      .byte_order = PBC_BYTE_ORDER,
+      .strings_num = chunk->strings_num,
+      .natives_num = natives_num,
+      .code_size = chunk->size,
+      .args_num = chunk->args_num,
+      .pad = 0,
+      .source_len = source_len,
+      .source_hash = hash_bytes64(source, source_len),
+      .payload_hash = hash_bytes64(payload.code, payload.size),
+  };
+  memcpy(header.magic, PBC_MAGIC, sizeof(header.magic));
+
+  // write next to it first so a reader never sees half a file
+  size_t path_len = strlen(path);
+  char *temp_path = malloc(path_len + sizeof(".tmp"));
+  assert(temp_path != NULL);
+  memcpy(temp_path, path, path_len);
+  memcpy(temp_path + path_len, ".tmp", sizeof(".tmp"));
+
+  bool ok = false;
+  FILE *file = fopen(temp_path, "wb");
+  if (file != NULL) {
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(payload.code, 1, payload.size, file) == payload.size;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok)
+      remove(temp_path);
+  }
+
+  free(temp_path);
+  delete_chunk(&payload);
+  return ok;
+}
+
+typedef struct PbcReader {
+  const uint8_t *data;
+  size_t size, pos;
+  bool ok; // cleared by the first read past the end
+} PbcReader;
+
+static const void *read_bytes(PbcReader *reader, size_t len) {
+  if (!reader->ok || len > reader->size - reader->pos) {
+    reader->ok = false;
+    return NULL;
+  }
+  const void *bytes = reader->data + reader->pos;
+  reader->pos += len;
+  return bytes;
+}
+
+static uint32_t read_u32(PbcReader *reader) {
+  uint32_t value = 0;
+  const void *bytes = read_bytes(reader, sizeof(value));
+  if (bytes != NULL)
+    memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static const char *read_text(PbcReader *reader, uint32_t *len) {
+  *len = read_u32(reader);
+  return read_bytes(reader, *len);
+}
+
+static bool load_chunk(PbcReader *reader, const PbcHeader *header,
+                       const Registry *registry, Chunk *chunk) {
+  for (uint32_t i = 0; i < header->strings_num; i++) {
+    uint32_t len;
+    const char *chars = read_text(reader, &len);
+    if (chars == NULL)
+      return false;
+    // indices in the code have to stay the same, so no duplicates
+    if (add_chunk_string(chunk, chars, len) != i)
+      return false;
+  }
+
+  // where each saved native index lives in this registry
+  size_t remap_num = 0;
+  uint32_t *remap = NULL;
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < header->natives_num; i++) {
+    uint32_t idx = read_u32(reader);
+    uint32_t name_len, signature_len;
+    const char *name = read_text(reader, &name_len);
+    const char *signature = read_text(reader, &signature_len);
+    if (!reader->ok || idx > UINT16_MAX) {
+      ok = false;
+      break;
+    }
+
+    size_t new_idx;
+    const NativeFn *fn = find_native_fn(registry, name, name_len, &new_idx);
+    if (fn == NULL || !compare_string(fn->signature, strlen(fn->signature),
+                                      signature, signature_len)) {
+      ok = false;
+      break;
+    }
+
+    if (idx >= remap_num) {
+      remap = realloc(remap, (idx + 1) * sizeof(*remap));
+      assert(remap != NULL);
+      for (size_t j = remap_num; j <= idx; j++)
+        remap[j] = UINT32_MAX;
+      remap_num = idx + 1;
+    }
+    remap[idx] = new_idx;
+  }
+
+  // args are checked against these before running, so they have to be types
+  // a value can actually have
+  const uint8_t *arg_types = read_bytes(reader, (size_t)header->args_num * 2);
+  ok = ok && arg_types != NULL;
+  for (uint32_t i = 0; ok && i < header->args_num; i++)
+    ok = arg_types[i * 2] <= ValueType_String && arg_types[i * 2 + 1] <= 1;
+
+  const uint8_t *code = read_bytes(reader, header->code_size);
+  ok = ok && code != NULL && reader->pos == reader->size;
+  if (ok) {
+    chunk->code = malloc(header->code_size + 1);
+    assert(chunk->code != NULL);
+    memcpy(chunk->code, code, header->code_size);
+    chunk->size = chunk->cap = header->code_size;
+
+    chunk->args_num = header->args_num;
+    chunk->arg_types = malloc((header->args_num + 1) * sizeof(TypeDef));
+    assert(chunk->arg_types != NULL);
+    for (uint32_t i = 0; i < header->args_num; i++) {
+      chunk->arg_types[i] =
+          new_type_def(arg_types[i * 2], arg_types[i * 2 + 1]);
+    }
+  }
+
+  // natives are stored by index in the code, point them at this registry
+  for (size_t pos = 0; ok && pos < chunk->size;) {
+    size_t size = bytecode_size(chunk->code[pos]);
+    if (size == 0 || size > chunk->size - pos) {
+      ok = false;
+      break;
+    }
+
+    if (chunk->code[pos] == Bytecode_NativeCall) {
+      size_t operand_pos = pos + 1;
+      uint16_t idx = read_chunk_u16(chunk, &operand_pos);
+      if (idx >= remap_num || remap[idx] == UINT32_MAX ||
+          remap[idx] > UINT16_MAX) {
+        ok = false;
+        break;
+      }
+      uint16_t new_idx = remap[idx];
+      memcpy(chunk->code + pos + 1, &new_idx, sizeof(new_idx));
+    }
+    pos += size;
+  }
+  free(remap);
+
+  return ok && verify_chunk(chunk, registry);
+}
+
+bool load_pbc(const char *path, const char *source, size_t source_len,
+              const Registry *registry, Chunk *out_chunk) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PbcHeader)) {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  PbcReader reader = {
+      .data = data,
+      .size = st.st_size,
+      .pos = 0,
+      .ok = true,
+  };
+  PbcHeader header;
+  memcpy(&header, read_bytes(&reader, sizeof(header)), sizeof(header));
+
+  bool ok = memcmp(header.magic, PBC_MAGIC, sizeof(PBC_MAGIC)) == 0 &&
+            header.version == PBC_VERSION &&
+            header.byte_order == PBC_BYTE_ORDER &&
+            header.source_len == source_len &&
+            header.source_hash == hash_bytes64(source, source_len) &&
+            header.payload_hash == hash_bytes64(reader.data + reader.pos,
+                                                reader.size - reader.pos);
+
+  Chunk chunk = new_chunk();
+  if (ok)
+    ok = load_chunk(&reader, &header, registry, &chunk);
+  munmap(data, st.st_size);
+
+  if (!ok) {
+    delete_chunk(&chunk);
+    return false;
+  }
+  *out_chunk = chunk;
+  return true;
+}
@@ -0,0 +1,329 @@
+#include "reg_bytecode.h"
+#include "expr.h"
+#include "reg_chunk.h"
+#include "registry.h"
+#include "type_def.h"
+#include "value.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t write_op(RegChunk *chunk, RegBytecode op, uint16_t a, uint32_t b,
+                       uint32_t c) {
+  return write_reg_chunk(chunk, (RegInstruction){
+                                    .op = op,
+                                    .a = a,
+                                    .b = b,
+                                    .c = c,
+                                });
+}
+
+static uint16_t alloc_temp(RegChunk *chunk, uint16_t *temp) {
+  assert(*temp < REG_NONE);
+  uint16_t reg = (*temp)++;
+  reserve_reg_chunk_regs(chunk, *temp);
+  return reg;
+}
+
+// returns the register holding the value of expr, variables are read in place
+// instead of being moved into a temporary first
+static uint16_t compile_operand(RegChunk *chunk, const Expr *expr,
+                                uint16_t *temp) {
+  if (expr->type == ExprType_GetVar)
+    return expr->get_var.idx;
+
+  uint16_t reg = alloc_temp(chunk, temp);
+  compile_reg_expr(chunk, expr, reg, *temp);
+  return reg;
+}
+
+static bool is_number_literal(const Expr *expr) {
+  return expr->type == ExprType_Literal &&
+         value_type(expr->literal) == ValueType_Number;
+}
+
+static bool is_short_circuit(const Expr *expr) {
+  return expr->type == ExprType_Binary &&
+         (expr->binary.op == BinaryOp_And || expr->binary.op == BinaryOp_Or);
+}
+
+static RegBytecode binary_op_to_reg_bytecode(BinaryOp op, bool constant_rhs) {
+  switch (op) {
+  case BinaryOp_Add:
+    return constant_rhs ? RegBytecode_AddK : RegBytecode_Add;
+  case BinaryOp_Subtract:
+    return constant_rhs ? RegBytecode_SubtractK : RegBytecode_Subtract;
+  case BinaryOp_Multiply:
+    return constant_rhs ? RegBytecode_MultiplyK : RegBytecode_Multiply;
+  case BinaryOp_Divide:
+    return constant_rhs ? RegBytecode_DivideK : RegBytecode_Divide;
+
+  case BinaryOp_Equal:
+    return RegBytecode_Equal;
+  case BinaryOp_NotEqual:
+    return RegBytecode_NotEqual;
+  case BinaryOp_Less:
+    return constant_rhs ? RegBytecode_LessK : RegBytecode_Less;
+  case BinaryOp_LessEqual:
+    return constant_rhs ? RegBytecode_LessEqualK : RegBytecode_LessEqual;
+  case BinaryOp_Greater:
+    return constant_rhs ? RegBytecode_GreaterK : RegBytecode_Greater;
+  case BinaryOp_GreaterEqual:
+    return constant_rhs ? RegBytecode_GreaterEqualK : RegBytecode_GreaterEqual;
+
+  default:
+    assert(0);
+    abort();
+  }
+}
+
+// narrows Equal/NotEqual when the parser proved both sides share a type
+static RegBytecode typed_equality(RegBytecode op, const Expr *lhs,
+                                  const Expr *rhs) {
+  bool equal = op == RegBytecode_Equal;
+  switch (common_type_def(lhs->return_type, rhs->return_type)) {
+  case ValueType_Number:
+    return equal ? RegBytecode_EqualNum : RegBytecode_NotEqualNum;
+  case ValueType_Boolean:
+    return equal ? RegBytecode_EqualBool : RegBytecode_NotEqualBool;
+  case ValueType_String:
+    return equal ? RegBytecode_EqualStr : RegBytecode_NotEqualStr;
+  default:
+    return op;
+  }
+}
+
+void compile_reg_expr(RegChunk *chunk, const Expr *expr, uint16_t dest,
+                      uint16_t temp) {
+  reserve_reg_chunk_regs(chunk, temp);
+  // only assignments and calls are worth running for their side effects, the
+  // rest still needs somewhere to put its result
+  if (dest == REG_NONE && expr->type != ExprType_SetVar &&
+      expr->type != ExprType_NativeCall)
+    dest = alloc_temp(chunk, &temp);
+
+  switch (expr->type) {
+  case ExprType_Literal:
+    switch (value_type(expr->literal)) {
+    case ValueType_Error:
+    case ValueType_Void:
+      assert(0);
+    case ValueType_Null:
+      write_op(chunk, RegBytecode_LoadNull, dest, 0, 0);
+      break;
+    case ValueType_Number:
+      write_op(chunk, RegBytecode_LoadNumber, dest,
+               add_reg_chunk_number(chunk, value_as_number(expr->literal)), 0);
+      break;
+    case ValueType_Boolean:
+      write_op(chunk, RegBytecode_LoadBoolean, dest,
+               value_as_boolean(expr->literal), 0);
+      break;
+    case ValueType_String: {
+      ObjString *string = value_as_string(expr->literal);
+      size_t idx = add_reg_chunk_string(chunk, string_chars(string),
+                                        string->len);
+      write_op(chunk, RegBytecode_LoadString, dest, idx, 0);
+      break;
+    }
+    }
+    break;
+  case ExprType_GetVar:
+    if (dest != expr->get_var.idx)
+      write_op(chunk, RegBytecode_Move, dest, expr->get_var.idx, 0);
+    break;
+  case ExprType_SetVar: {
+    uint16_t var = expr->set_var.idx;
+    if (is_short_circuit(expr->set_var.value)) {
+      // and & or write their destination before the right hand side runs,
+      // which might still want to read the old value of the variable
+      uint16_t reg = alloc_temp(chunk, &temp);
+      compile_reg_expr(chunk, expr->set_var.value, reg, temp);
+      write_op(chunk, RegBytecode_Move, var, reg, 0);
+    } else {
+      compile_reg_expr(chunk, expr->set_var.value, var, temp);
+    }
+
+    if (dest != REG_NONE && dest != var)
+      write_op(chunk, RegBytecode_Move, dest, var, 0);
+    break;
+  }
+
+  case ExprType_NativeCall: {
+    // arguments go into consecutive registers, the callee consumes them
+    uint16_t base = temp;
+    uint8_t argc = 0;
+    for (Expr *arg = expr->call.argv_head; arg != NULL; arg = arg->next) {
+      alloc_temp(chunk, &temp);
+      argc++;
+    }
+
+    uint16_t reg = base;
+    for (Expr *arg = expr->call.argv_head; arg != NULL; arg = arg->next)
+      compile_reg_expr(chunk, arg, reg++, temp);
+
+    write_reg_chunk(chunk, (RegInstruction){
+                               .op = RegBytecode_NativeCall,
+                               .argc = argc,
+                               .a = dest,
+                               .b = expr->call.idx,
+                               .c = base,
+                           });
+    break;
+  }
+
+  case ExprType_Unary: {
+    uint16_t operand = compile_operand(chunk, expr->unary.operand, &temp);
+    write_op(chunk,
+             (expr->unary.op == UnaryOp_Negate) ? RegBytecode_Negate
+                                                : RegBytecode_Not,
+             dest, operand, 0);
+    break;
+  }
+  case ExprType_Binary: {
+    const Expr *lhs_expr = expr->binary.lhs, *rhs_expr = expr->binary.rhs;
+
+    if (is_short_circuit(expr)) {
+      compile_reg_expr(chunk, lhs_expr, dest, temp);
+      size_t skip_rhs_jump = write_op(chunk,
+                                      (expr->binary.op == BinaryOp_And)
+                                          ? RegBytecode_JumpIfFalse
+                                          : RegBytecode_JumpIfTrue,
+                                      dest, 0, 0);
+
+      // rhs is only evaluated if lhs didn't already decide the result
+      compile_reg_expr(chunk, rhs_expr, dest, temp);
+      patch_reg_chunk_jump(chunk, skip_rhs_jump);
+      break;
+    }
+
+    uint16_t lhs = compile_operand(chunk, lhs_expr, &temp);
+    if (expr->binary.op == BinaryOp_Add &&
+        is_type_def_string(lhs_expr->return_type)) {
+      uint16_t rhs = compile_operand(chunk, rhs_expr, &temp);
+      write_op(chunk, RegBytecode_Concat, dest, lhs, rhs);
+      break;
+    }
+
+    bool constant_rhs =
+        is_number_literal(rhs_expr) && expr->binary.op != BinaryOp_Equal &&
+        expr->binary.op != BinaryOp_NotEqual;
+    uint32_t rhs;
+    if (constant_rhs) {
+      rhs = add_reg_chunk_number(chunk, value_as_number(rhs_expr->literal));
+    } else {
+      rhs = compile_operand(chunk, rhs_expr, &temp);
+    }
+    RegBytecode op = binary_op_to_reg_bytecode(expr->binary.op, constant_rhs);
+    if (op == RegBytecode_Equal || op == RegBytecode_NotEqual)
+      op = typed_equality(op, lhs_expr, rhs_expr);
+    write_op(chunk, op, dest, lhs, rhs);
+    break;
+  }
+  }
+}
+
+void disassemble_reg_chunk(const RegChunk *chunk, const Registry *registry) {
+#define ABC_OP(enum_name, text)                                                \
+  case RegBytecode_##enum_name:                                                \
+    printf(text " r%d, r%u, r%u\n", ins->a, ins->b, ins->c);                   \
+    break;
+#define ABK_OP(enum_name, text)                                                \
+  case RegBytecode_##enum_name:                                                \
+    printf(text " r%d, r%u, %g\n", ins->a, ins->b, chunk->numbers[ins->c]);    \
+    break;
+
+  for (size_t pos = 0; pos < chunk->size; pos++) {
+    printf("%zu\t| ", pos);
+
+    const RegInstruction *ins = &chunk->code[pos];
+    switch ((RegBytecode)ins->op) {
+    case RegBytecode_LoadNull:
+      printf("load_null r%d\n", ins->a);
+      break;
+    case RegBytecode_LoadBoolean:
+      printf("load_boolean r%d, %s\n", ins->a, ins->b ? "true" : "false");
+      break;
+    case RegBytecode_LoadNumber:
+      printf("load_number r%d, %g\n", ins->a, chunk->numbers[ins->b]);
+      break;
+    case RegBytecode_LoadString:
+      printf("load_string r%d, \"%s\"\n", ins->a,
+             value_as_c_string(chunk->constants.strings[ins->b]));
+      break;
+    case RegBytecode_Move:
+      printf("move r%d, r%u\n", ins->a, ins->b);
+      break;
+
+    case RegBytecode_NativeCall:
+      assert(ins->b < registry->native_fns_num);
+      if (ins->a == REG_NONE)
+        printf("native_call _, %s, r%u (%d args)\n",
+               registry->native_fns[ins->b].name, ins->c, ins->argc);
+      else
+        printf("native_call r%d, %s, r%u (%d args)\n", ins->a,
+               registry->native_fns[ins->b].name, ins->c, ins->argc);
+      break;
+
+    case RegBytecode_Negate:
+      printf("negate r%d, r%u\n", ins->a, ins->b);
+      break;
+    case RegBytecode_Not:
+      printf("not r%d, r%u\n", ins->a, ins->b);
+      break;
+
+      ABC_OP(Add, "add")
+      ABC_OP(Subtract, "subtract")
+      ABC_OP(Multiply, "multiply")
+      ABC_OP(Divide, "divide")
+
+      ABK_OP(AddK, "add")
+      ABK_OP(SubtractK, "subtract")
+      ABK_OP(MultiplyK, "multiply")
+      ABK_OP(DivideK, "divide")
+
+      ABC_OP(Equal, "equal")
+      ABC_OP(NotEqual, "not_equal")
+      ABC_OP(Less, "less")
+      ABC_OP(LessEqual, "less_equal")
+      ABC_OP(Greater, "greater")
+      ABC_OP(GreaterEqual, "greater_equal")
+      ABC_OP(EqualNum, "equal_num")
+      ABC_OP(NotEqualNum, "not_equal_num")
+      ABC_OP(EqualBool, "equal_bool")
+      ABC_OP(NotEqualBool, "not_equal_bool")
+      ABC_OP(EqualStr, "equal_str")
+      ABC_OP(NotEqualStr, "not_equal_str")
+
+      ABK_OP(LessK, "less")
+      ABK_OP(LessEqualK, "less_equal")
+      ABK_OP(GreaterK, "greater")
+      ABK_OP(GreaterEqualK, "greater_equal")
+
+      ABC_OP(Concat, "concat")
+
+    case RegBytecode_Jump:
+      printf("jump @%u\n", ins->b);
+      break;
+    case RegBytecode_JumpIfFalse:
+      printf("jump_if_false r%d, @%u\n", ins->a, ins->b);
+      break;
+    case RegBytecode_JumpIfTrue:
+      printf("jump_if_true r%d, @%u\n", ins->a, ins->b);
+      break;
+
+    case RegBytecode_Return:
+      printf("return r%d\n", ins->a);
+      break;
+    case RegBytecode_Halt:
+      printf("halt\n");
+      break;
+    }
+  }
+
+#undef ABK_OP
+#undef ABC_OP
+}
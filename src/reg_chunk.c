@@ -0,0 +1,73 @@
+#include "reg_chunk.h"
+#include "chunk.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+RegChunk new_reg_chunk() {
+  return (RegChunk){
+      .constants = new_chunk(),
+
+      .numbers_num = 0,
+      .numbers = NULL,
+
+      .size = 0,
+      .cap = 0,
+      .code = NULL,
+
+      .regs_num = 0,
+  };
+}
+
+void delete_reg_chunk(RegChunk *chunk) {
+  delete_chunk(&chunk->constants);
+  free(chunk->numbers);
+  free(chunk->code);
+}
+
+size_t add_reg_chunk_string(RegChunk *chunk, const char *chars, uint32_t len) {
+  return add_chunk_string(&chunk->constants, chars, len);
+}
+
+size_t add_reg_chunk_number(RegChunk *chunk, double number) {
+  for (size_t i = 0; i < chunk->numbers_num; i++) {
+    // compare the bits so -0 and 0 stay apart
+    if (memcmp(&chunk->numbers[i], &number, sizeof(number)) == 0)
+      return i; // already exists
+  }
+
+  chunk->numbers = realloc(chunk->numbers,
+                           (chunk->numbers_num + 1) * sizeof(*chunk->numbers));
+  assert(chunk->numbers != NULL);
+
+  chunk->numbers[chunk->numbers_num++] = number;
+  return chunk->numbers_num - 1;
+}
+
+void reserve_reg_chunk_regs(RegChunk *chunk, size_t regs_num) {
+  if (regs_num > chunk->regs_num)
+    chunk->regs_num = regs_num;
+}
+
+size_t write_reg_chunk(RegChunk *chunk, RegInstruction instruction) {
+  if (chunk->size + 1 > chunk->cap) {
+    chunk->cap = (chunk->cap == 0) ? 8 : chunk->cap * 2;
+    chunk->code = realloc(chunk->code, chunk->cap * sizeof(*chunk->code));
+    assert(chunk->code != NULL);
+  }
+
+  chunk->code[chunk->size] = instruction;
+  return chunk->size++;
+}
+
+void patch_reg_chunk_jump(RegChunk *chunk, size_t pos) {
+  assert(pos < chunk->size);
+  chunk->code[pos].b = chunk->size;
+}
+
+void truncate_reg_chunk(RegChunk *chunk, size_t size) {
+  assert(size <= chunk->size);
+  chunk->size = size;
+}
@@ -0,0 +1,276 @@
+#include "reg_vm.h"
+#include "heap.h"
+#include "reg_bytecode.h"
+#include "reg_chunk.h"
+#include "registry.h"
+#include "type_def.h"
+#include "value.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+RegVm new_reg_vm(const RegChunk *chunk, const Registry *registry) {
+  RegVm vm = {
+      .chunk = chunk,
+      .registry = registry,
+
+      .regs = malloc(chunk->regs_num * sizeof(*vm.regs)),
+      .pc = 0,
+
+      .error = NULL,
+      .result = new_null_value(),
+
+      .heap = new_heap(),
+      .executed = 0,
+  };
+  assert(chunk->regs_num == 0 || vm.regs != NULL);
+
+  for (size_t i = 0; i < chunk->regs_num; i++)
+    vm.regs[i] = new_null_value();
+  return vm;
+}
+
+void delete_reg_vm(RegVm *vm) {
+  for (size_t i = 0; i < vm->chunk->regs_num; i++)
+    release_value(vm->regs[i]);
+  release_value(vm->result);
+  free(vm->regs);
+  delete_heap(vm->heap);
+}
+
+// overwrites a register, letting go of whatever it held before
+static void set_reg(Value *regs, uint16_t idx, Value value) {
+  release_value(regs[idx]);
+  regs[idx] = value;
+}
+
+#ifdef VM_STATS
+#define COUNT_INSTRUCTION() executed++
+#else
+#define COUNT_INSTRUCTION() (void)0
+#endif
+
+// same dispatch scheme as the stack vm, see vm.c
+#ifdef VM_THREADED_DISPATCH
+#define VM_CASE(enum_name) op_##enum_name:
+#define VM_NEXT()                                                              \
+  do {                                                                         \
+    COUNT_INSTRUCTION();                                                       \
+    ins = &code[++pc];                                                         \
+    goto *labels[ins->op];                                                     \
+  } while (0)
+#else
+#define VM_CASE(enum_name) case RegBytecode_##enum_name:
+#define VM_NEXT() continue
+#endif
+
+// the following VM_NEXT steps onto the target
+#define VM_JUMP(target) (pc = (target)-1)
+
+Value run_reg_vm(RegVm *vm) {
+#define ARITHMETIC_OP(enum_name, op)                                           \
+  VM_CASE(enum_name) {                                                         \
+    double lhs = proven_number(regs[ins->b]);                                  \
+    double rhs = proven_number(regs[ins->c]);                                  \
+    set_reg(regs, ins->a, new_number_value(lhs op rhs));                       \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(enum_name##K) {                                                      \
+    double lhs = proven_number(regs[ins->b]);                                  \
+    set_reg(regs, ins->a, new_number_value(lhs op numbers[ins->c]));           \
+    VM_NEXT();                                                                 \
+  }
+#define RELATIONAL_OP(enum_name, op)                                           \
+  VM_CASE(enum_name) {                                                         \
+    double lhs = proven_number(regs[ins->b]);                                  \
+    double rhs = proven_number(regs[ins->c]);                                  \
+    set_reg(regs, ins->a, new_boolean_value(lhs op rhs));                      \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(enum_name##K) {                                                      \
+    double lhs = proven_number(regs[ins->b]);                                  \
+    set_reg(regs, ins->a, new_boolean_value(lhs op numbers[ins->c]));          \
+    VM_NEXT();                                                                 \
+  }
+
+#define EQUALITY_OP(type_name, equal)                                          \
+  VM_CASE(Equal##type_name) {                                                  \
+    set_reg(regs, ins->a, new_boolean_value(equal));                           \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(NotEqual##type_name) {                                               \
+    set_reg(regs, ins->a, new_boolean_value(!(equal)));                        \
+    VM_NEXT();                                                                 \
+  }
+
+  Heap *previous_heap = set_current_heap(vm->heap);
+  const RegInstruction *code = vm->chunk->code;
+  const double *numbers = vm->chunk->numbers;
+  Value *regs = vm->regs;
+  size_t pc = vm->pc;
+  size_t executed = 0;
+  const RegInstruction *ins;
+
+#ifdef VM_THREADED_DISPATCH
+#define LABEL(enum_name) [RegBytecode_##enum_name] = &&op_##enum_name
+  static const void *const labels[] = {
+      LABEL(LoadNull),      LABEL(LoadBoolean),    LABEL(LoadNumber),
+      LABEL(LoadString),    LABEL(Move),
+
+      LABEL(NativeCall),
+
+      LABEL(Negate),        LABEL(Not),
+
+      LABEL(Add),           LABEL(Subtract),       LABEL(Multiply),
+      LABEL(Divide),        LABEL(AddK),           LABEL(SubtractK),
+      LABEL(MultiplyK),     LABEL(DivideK),
+
+      LABEL(Equal),         LABEL(NotEqual),       LABEL(Less),
+      LABEL(LessEqual),     LABEL(Greater),        LABEL(GreaterEqual),
+      LABEL(EqualNum),      LABEL(NotEqualNum),    LABEL(EqualBool),
+      LABEL(NotEqualBool),  LABEL(EqualStr),       LABEL(NotEqualStr),
+      LABEL(LessK),         LABEL(LessEqualK),     LABEL(GreaterK),
+      LABEL(GreaterEqualK),
+
+      LABEL(Concat),
+
+      LABEL(Jump),          LABEL(JumpIfFalse),    LABEL(JumpIfTrue),
+
+      LABEL(Return),        LABEL(Halt),
+  };
+#undef LABEL
+
+  COUNT_INSTRUCTION();
+  ins = &code[pc];
+  goto *labels[ins->op];
+#else
+  for (;; pc++) {
+    COUNT_INSTRUCTION();
+    ins = &code[pc];
+    switch ((RegBytecode)ins->op) {
+#endif
+    VM_CASE(LoadNull) {
+      set_reg(regs, ins->a, new_null_value());
+      VM_NEXT();
+    }
+    VM_CASE(LoadBoolean) {
+      set_reg(regs, ins->a, new_boolean_value(ins->b));
+      VM_NEXT();
+    }
+    VM_CASE(LoadNumber) {
+      set_reg(regs, ins->a, new_number_value(numbers[ins->b]));
+      VM_NEXT();
+    }
+    VM_CASE(LoadString) {
+      set_reg(regs, ins->a, vm->chunk->constants.strings[ins->b]);
+      VM_NEXT();
+    }
+    VM_CASE(Move) {
+      set_reg(regs, ins->a, copy_value(regs[ins->b]));
+      VM_NEXT();
+    }
+
+    VM_CASE(NativeCall) {
+      assert(ins->b < vm->registry->native_fns_num);
+      const NativeFn *native_fn = &vm->registry->native_fns[ins->b];
+      assert(ins->argc >= native_fn->args_num);
+
+      // natives only get to see a Vm when called from the stack vm
+      Value *argv = regs + ins->c;
+      Value result = native_fn->ptr(NULL, ins->argc, argv);
+
+      // the arguments are consumed by the call
+      for (size_t i = 0; i < ins->argc; i++)
+        set_reg(regs, ins->c + i, new_null_value());
+
+      if (ins->a != REG_NONE && !is_type_def_void(native_fn->return_type))
+        set_reg(regs, ins->a, result);
+      else
+        release_value(result);
+      VM_NEXT();
+    }
+
+    VM_CASE(Negate) {
+      double operand = proven_number(regs[ins->b]);
+      set_reg(regs, ins->a, new_number_value(-operand));
+      VM_NEXT();
+    }
+    VM_CASE(Not) {
+      bool operand = proven_boolean(regs[ins->b]);
+      set_reg(regs, ins->a, new_boolean_value(!operand));
+      VM_NEXT();
+    }
+
+    ARITHMETIC_OP(Add, +)
+    ARITHMETIC_OP(Subtract, -)
+    ARITHMETIC_OP(Multiply, *)
+    ARITHMETIC_OP(Divide, /)
+
+    VM_CASE(Equal) {
+      bool result = value_compare(regs[ins->b], regs[ins->c]);
+      set_reg(regs, ins->a, new_boolean_value(result));
+      VM_NEXT();
+    }
+    VM_CASE(NotEqual) {
+      bool result = !value_compare(regs[ins->b], regs[ins->c]);
+      set_reg(regs, ins->a, new_boolean_value(result));
+      VM_NEXT();
+    }
+    RELATIONAL_OP(Less, <)
+    RELATIONAL_OP(LessEqual, <=)
+    RELATIONAL_OP(Greater, >)
+    RELATIONAL_OP(GreaterEqual, >=)
+
+    EQUALITY_OP(Num, proven_number(regs[ins->b]) == proven_number(regs[ins->c]))
+    EQUALITY_OP(Bool,
+                proven_boolean(regs[ins->b]) == proven_boolean(regs[ins->c]))
+    EQUALITY_OP(Str, string_compare(proven_string(regs[ins->b]),
+                                    proven_string(regs[ins->c])))
+
+    VM_CASE(Concat) {
+      // the operands may be the destination itself, so concat first
+      Value result;
+      if (!value_concat(regs[ins->b], regs[ins->c], &result)) {
+        vm->error = "string too long";
+        goto halt;
+      }
+      set_reg(regs, ins->a, result);
+      VM_NEXT();
+    }
+
+    VM_CASE(Jump) {
+      VM_JUMP(ins->b);
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfFalse) {
+      if (!proven_boolean(regs[ins->a]))
+        VM_JUMP(ins->b);
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfTrue) {
+      if (proven_boolean(regs[ins->a]))
+        VM_JUMP(ins->b);
+      VM_NEXT();
+    }
+
+    VM_CASE(Return) {
+      vm->result = copy_value(regs[ins->a]);
+      goto halt;
+    }
+    VM_CASE(Halt) { goto halt; }
+#ifndef VM_THREADED_DISPATCH
+    }
+  }
+#endif
+#undef EQUALITY_OP
+#undef RELATIONAL_OP
+#undef ARITHMETIC_OP
+
+halt:
+  vm->pc = pc;
+  vm->executed += executed;
+  set_current_heap(previous_heap);
+  return vm->result;
+}
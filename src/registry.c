@@ -1,9 +1,11 @@
 #include "registry.h"
 #include "lexer.h"
 #include "type_def.h"
+#include "utility.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,17 +18,45 @@ static bool match(Lexer *lexer, TokenType what) {
   return true;
 }
 
-static void assert_not_defined(const Registry *registry, const char *name) {
+static uint32_t *find_slot(uint32_t *slots, size_t cap,
+                           const NativeFn *native_fns, const char *name,
+                           size_t name_len, uint32_t hash) {
+  size_t mask = cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    if (slots[i] == 0)
+      return &slots[i];
+
+    const NativeFn *fn = &native_fns[slots[i] - 1];
+    if (fn->name_hash == hash &&
+        compare_string(fn->name, fn->name_len, name, name_len))
+      return &slots[i];
+  }
+}
+
+static void grow_slots(Registry *registry) {
+  size_t cap = registry->slots_cap == 0 ? 64 : registry->slots_cap * 2;
+  uint32_t *slots = calloc(cap, sizeof(*slots));
+  assert(slots != NULL);
+
   for (size_t i = 0; i < registry->native_fns_num; i++) {
-    if (strcmp(registry->native_fns[i].name, name) == 0)
-      assert(0 && "a native function with that name is already defined");
+    const NativeFn *fn = &registry->native_fns[i];
+    *find_slot(slots, cap, registry->native_fns, fn->name, fn->name_len,
+               fn->name_hash) = i + 1;
   }
+
+  free(registry->slots);
+  registry->slots_cap = cap;
+  registry->slots = slots;
 }
 
 Registry new_registry() {
   return (Registry){
       .native_fns_num = 0,
+      .native_fns_cap = 0,
       .native_fns = NULL,
+
+      .slots_cap = 0,
+      .slots = NULL,
   };
 }
 
@@ -35,12 +65,30 @@ void delete_registry(Registry *registry) {
     NativeFn *native_fn = &registry->native_fns[i];
     free(native_fn->arg_types);
     free(native_fn->name);
+    free(native_fn->signature);
   }
   free(registry->native_fns);
+  free(registry->slots);
+}
+
+const NativeFn *find_native_fn(const Registry *registry, const char *name,
+                               size_t name_len, size_t *out_idx) {
+  if (registry->slots_cap == 0)
+    return NULL;
+
+  uint32_t slot =
+      *find_slot(registry->slots, registry->slots_cap, registry->native_fns,
+                 name, name_len, hash_string(name, name_len));
+  if (slot == 0)
+    return NULL;
+
+  if (out_idx != NULL)
+    *out_idx = slot - 1;
+  return &registry->native_fns[slot - 1];
 }
 
 void register_native_fn(Registry *registry, const char *sig, NativeFnPtr ptr) {
-  Lexer lexer = new_lexer(sig);
+  Lexer lexer = new_lexer(sig, strlen(sig));
   TypeDef return_type = parse_type_def(&lexer);
   if (return_type.value == ValueType_Error)
     assert(0 && "bad return type");
@@ -50,13 +98,18 @@ void register_native_fn(Registry *registry, const char *sig, NativeFnPtr ptr) {
     assert(0 && "expected identifier after return type");
   lexer_advance(&lexer);
 
-  char *name = strndup(name_token.text.start, name_token.text.len);
+  size_t name_len = name_token.text.len;
+  if (find_native_fn(registry, name_token.text.start, name_len, NULL) != NULL)
+    assert(0 && "a native function with that name is already defined");
+  char *name = strndup(name_token.text.start, name_len);
   assert(name != NULL);
-  assert_not_defined(registry, name);
 
   NativeFn native_fn = {
       .return_type = return_type,
       .name = name,
+      .name_len = name_len,
+      .name_hash = hash_string(name, name_len),
+      .signature = strdup(sig),
 
       .args_num = 0,
       .arg_types = NULL,
@@ -65,6 +118,8 @@ void register_native_fn(Registry *registry, const char *sig, NativeFnPtr ptr) {
       .ptr = ptr,
   };
 
+  assert(native_fn.signature != NULL);
+
   // arguments
   if (!match(&lexer, TokenType_LParen))
     assert(0 && "expected '(' after identifier");
@@ -98,10 +153,19 @@ void register_native_fn(Registry *registry, const char *sig, NativeFnPtr ptr) {
     assert(0 && "expected ')' to close '('");
 
   // let's not forget to add the function itself
-  size_t new_size =
-      (registry->native_fns_num + 1) * sizeof(*registry->native_fns);
-  registry->native_fns = realloc(registry->native_fns, new_size);
-  assert(registry->native_fns != NULL);
+  if (registry->native_fns_num == registry->native_fns_cap) {
+    registry->native_fns_cap =
+        registry->native_fns_cap == 0 ? 16 : registry->native_fns_cap * 2;
+    registry->native_fns =
+        realloc(registry->native_fns,
+                registry->native_fns_cap * sizeof(*registry->native_fns));
+    assert(registry->native_fns != NULL);
+  }
+  if ((registry->native_fns_num + 1) * 4 > registry->slots_cap * 3)
+    grow_slots(registry);
 
   registry->native_fns[registry->native_fns_num++] = native_fn;
+  *find_slot(registry->slots, registry->slots_cap, registry->native_fns,
+             native_fn.name, native_fn.name_len, native_fn.name_hash) =
+      registry->native_fns_num;
 }
\ No newline at end of file
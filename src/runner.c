@@ -0,0 +1,321 @@
+#include "runner.h"
+#include "chunk.h"
+#include "heap.h"
+#include "registry.h"
+#include "value.h"
+#include "vm.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { CACHE_LINE_SIZE = 64 };
+
+typedef struct RunnerWorker {
+  // jobs this worker hasn't started yet, begin in the low half and end in the
+  // high half. the owner takes from the front, thieves from the back
+  _Alignas(CACHE_LINE_SIZE) atomic_uint_least64_t range;
+
+  Runner *runner;
+  size_t idx;
+  pthread_t thread;
+  // made once and reset between jobs
+  Vm vm;
+} RunnerWorker;
+
+static uint64_t pack_range(uint32_t begin, uint32_t end) {
+  return (uint64_t)end << 32 | begin;
+}
+
+static uint32_t range_begin(uint64_t range) { return (uint32_t)range; }
+static uint32_t range_end(uint64_t range) { return range >> 32; }
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// the vm's objects go away on reset, so strings are copied into a heap the
+// batch owns
+static Value keep_value(Heap *heap, Value value) {
+  if (value_type(value) != ValueType_String)
+    return value;
+
+  ObjString *string = value_as_string(value);
+  if (string->ref_count == REF_COUNT_IMMORTAL)
+    return value;
+
+  Heap *previous_heap = set_current_heap(heap);
+  Value copy = new_immortal_string_value(string_chars(string), string->len);
+  set_current_heap(previous_heap);
+  return copy;
+}
+
+static void run_job(RunnerWorker *worker, size_t idx) {
+  Runner *runner = worker->runner;
+  const RunnerJob *job = &runner->jobs[idx];
+  Batch *batch = runner->batch;
+
+  uint64_t start = (batch != NULL) ? now_ns() : 0;
+  Value result = run_vm_args(&worker->vm, job->args, job->args_num);
+  if (batch != NULL) {
+    batch->latencies_ns[idx] = now_ns() - start;
+    batch->results[idx] = keep_value(batch->heaps[worker->idx], result);
+    batch->errors[idx] = worker->vm.error;
+  } else if (runner->on_result != NULL) {
+    runner->on_result(runner->user, idx, result, worker->vm.error);
+  }
+  reset_vm(&worker->vm);
+}
+
+// takes the next job of the worker's own share
+static bool take_job(RunnerWorker *worker, size_t *out_idx) {
+  uint64_t range = atomic_load_explicit(&worker->range, memory_order_relaxed);
+  while (range_begin(range) < range_end(range)) {
+    uint64_t taken = pack_range(range_begin(range) + 1, range_end(range));
+    if (atomic_compare_exchange_weak_explicit(&worker->range, &range, taken,
+                                              memory_order_relaxed,
+                                              memory_order_relaxed)) {
+      *out_idx = range_begin(range);
+      return true;
+    }
+  }
+  return false;
+}
+
+// moves the back half of some other worker's share over to this one, false
+// once everybody is out of work
+static bool steal_jobs(RunnerWorker *worker) {
+  Runner *runner = worker->runner;
+  for (size_t i = 1; i < runner->workers_num; i++) {
+    RunnerWorker *victim =
+        &runner->workers[(worker->idx + i) % runner->workers_num];
+
+    uint64_t range =
+        atomic_load_explicit(&victim->range, memory_order_relaxed);
+    while (range_begin(range) < range_end(range)) {
+      uint32_t begin = range_begin(range), end = range_end(range);
+      uint32_t half = (end - begin + 1) / 2;
+      if (atomic_compare_exchange_weak_explicit(
+              &victim->range, &range, pack_range(begin, end - half),
+              memory_order_relaxed, memory_order_relaxed)) {
+        // nobody steals from an empty share, so this can't race
+        atomic_store_explicit(&worker->range, pack_range(end - half, end),
+                              memory_order_relaxed);
+        atomic_fetch_add_explicit(&runner->steals, 1, memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void *worker_main(void *arg) {
+  RunnerWorker *worker = arg;
+  Runner *runner = worker->runner;
+  size_t seen_batch = 0;
+
+  pthread_mutex_lock(&runner->lock);
+  for (;;) {
+    while (!runner->stopping && runner->batch_id == seen_batch)
+      pthread_cond_wait(&runner->batch_ready, &runner->lock);
+    if (runner->stopping)
+      break;
+    seen_batch = runner->batch_id;
+    pthread_mutex_unlock(&runner->lock);
+
+    do {
+      size_t idx;
+      while (take_job(worker, &idx))
+        run_job(worker, idx);
+    } while (steal_jobs(worker));
+
+    pthread_mutex_lock(&runner->lock);
+    if (--runner->busy_workers == 0)
+      pthread_cond_signal(&runner->batch_done);
+  }
+  pthread_mutex_unlock(&runner->lock);
+  return NULL;
+}
+
+Runner *new_runner(const Chunk *chunk, const Registry *registry,
+                   size_t workers_num) {
+  assert(workers_num != 0);
+  Runner *runner = malloc(sizeof(*runner));
+  assert(runner != NULL);
+
+  // workers sit on their own cache lines so stealing doesn't slow down
+  // everybody else
+  size_t workers_size = workers_num * sizeof(*runner->workers);
+  *runner = (Runner){
+      .chunk = chunk,
+      .registry = registry,
+
+      .workers_num = workers_num,
+      .workers = aligned_alloc(CACHE_LINE_SIZE, workers_size),
+
+      .batch_id = 0,
+      .busy_workers = 0,
+      .stopping = false,
+
+      .jobs = NULL,
+      .jobs_num = 0,
+      .on_result = NULL,
+      .user = NULL,
+      .batch = NULL,
+  };
+  assert(runner->workers != NULL);
+  atomic_init(&runner->steals, 0);
+  pthread_mutex_init(&runner->lock, NULL);
+  pthread_cond_init(&runner->batch_ready, NULL);
+  pthread_cond_init(&runner->batch_done, NULL);
+
+  for (size_t i = 0; i < workers_num; i++) {
+    RunnerWorker *worker = &runner->workers[i];
+    atomic_init(&worker->range, pack_range(0, 0));
+    worker->runner = runner;
+    worker->idx = i;
+    worker->vm = new_vm(chunk, registry);
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+      puts("couldn't start a runner thread");
+      exit(-1);
+    }
+  }
+  return runner;
+}
+
+void delete_runner(Runner *runner) {
+  pthread_mutex_lock(&runner->lock);
+  runner->stopping = true;
+  pthread_cond_broadcast(&runner->batch_ready);
+  pthread_mutex_unlock(&runner->lock);
+
+  for (size_t i = 0; i < runner->workers_num; i++) {
+    RunnerWorker *worker = &runner->workers[i];
+    pthread_join(worker->thread, NULL);
+    delete_vm(&worker->vm);
+  }
+
+  pthread_cond_destroy(&runner->batch_done);
+  pthread_cond_destroy(&runner->batch_ready);
+  pthread_mutex_destroy(&runner->lock);
+  free(runner->workers);
+  free(runner);
+}
+
+static void run_jobs(Runner *runner, const RunnerJob *jobs, size_t jobs_num) {
+  assert(jobs_num <= UINT32_MAX);
+
+  pthread_mutex_lock(&runner->lock);
+  runner->jobs = jobs;
+  runner->jobs_num = jobs_num;
+  atomic_store_explicit(&runner->steals, 0, memory_order_relaxed);
+  // even shares to start with, in order so each worker walks its jobs front
+  // to back
+  for (size_t i = 0; i < runner->workers_num; i++) {
+    size_t begin = jobs_num * i / runner->workers_num;
+    size_t end = jobs_num * (i + 1) / runner->workers_num;
+    atomic_store_explicit(&runner->workers[i].range, pack_range(begin, end),
+                          memory_order_relaxed);
+  }
+
+  runner->busy_workers = runner->workers_num;
+  runner->batch_id++;
+  pthread_cond_broadcast(&runner->batch_ready);
+  while (runner->busy_workers != 0)
+    pthread_cond_wait(&runner->batch_done, &runner->lock);
+  pthread_mutex_unlock(&runner->lock);
+}
+
+void runner_run(Runner *runner, const RunnerJob *jobs, size_t jobs_num,
+                RunnerResultFn on_result, void *user) {
+  runner->on_result = on_result;
+  runner->user = user;
+  runner->batch = NULL;
+  run_jobs(runner, jobs, jobs_num);
+}
+
+static int compare_latencies(const void *lhs, const void *rhs) {
+  uint64_t lhs_ns = *(const uint64_t *)lhs, rhs_ns = *(const uint64_t *)rhs;
+  return (lhs_ns > rhs_ns) - (lhs_ns < rhs_ns);
+}
+
+// nearest rank over latencies already sorted
+static uint64_t percentile(const uint64_t *sorted, size_t num, double p) {
+  size_t rank = (size_t)(p * num);
+  return sorted[rank < num ? rank : num - 1];
+}
+
+static BatchStats get_batch_stats(const Batch *batch, size_t steals) {
+  BatchStats stats = {
+      .errors = 0,
+      .steals = steals,
+  };
+  if (batch->jobs_num == 0)
+    return stats;
+
+  uint64_t *sorted = malloc(batch->jobs_num * sizeof(*sorted));
+  assert(sorted != NULL);
+  memcpy(sorted, batch->latencies_ns, batch->jobs_num * sizeof(*sorted));
+  qsort(sorted, batch->jobs_num, sizeof(*sorted), compare_latencies);
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < batch->jobs_num; i++) {
+    total += sorted[i];
+    if (batch->errors[i] != NULL)
+      stats.errors++;
+  }
+  stats.mean_ns = total / batch->jobs_num;
+  stats.p50_ns = percentile(sorted, batch->jobs_num, 0.5);
+  stats.p90_ns = percentile(sorted, batch->jobs_num, 0.9);
+  stats.p99_ns = percentile(sorted, batch->jobs_num, 0.99);
+  stats.p999_ns = percentile(sorted, batch->jobs_num, 0.999);
+  stats.max_ns = sorted[batch->jobs_num - 1];
+
+  free(sorted);
+  return stats;
+}
+
+Batch run_batch(Runner *runner, const RunnerJob *jobs, size_t jobs_num) {
+  Batch batch = {
+      .jobs_num = jobs_num,
+      .results = malloc(jobs_num * sizeof(*batch.results)),
+      .errors = malloc(jobs_num * sizeof(*batch.errors)),
+      .latencies_ns = malloc(jobs_num * sizeof(*batch.latencies_ns)),
+      .stats = {},
+
+      .heaps_num = runner->workers_num,
+      .heaps = malloc(runner->workers_num * sizeof(*batch.heaps)),
+  };
+  assert(jobs_num == 0 || (batch.results != NULL && batch.errors != NULL &&
+                           batch.latencies_ns != NULL));
+  assert(batch.heaps != NULL);
+  for (size_t i = 0; i < batch.heaps_num; i++)
+    batch.heaps[i] = new_heap();
+
+  runner->on_result = NULL;
+  runner->user = NULL;
+  runner->batch = &batch;
+  run_jobs(runner, jobs, jobs_num);
+  runner->batch = NULL;
+
+  batch.stats = get_batch_stats(
+      &batch, atomic_load_explicit(&runner->steals, memory_order_relaxed));
+  return batch;
+}
+
+void delete_batch(Batch *batch) {
+  for (size_t i = 0; i < batch->heaps_num; i++)
+    delete_heap(batch->heaps[i]);
+  free(batch->heaps);
+  free(batch->latencies_ns);
+  free(batch->errors);
+  free(batch->results);
+}
@@ -0,0 +1,83 @@
+#include "source.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { READ_CHUNK_SIZE = 64 * 1024 };
+
+Source load_source_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("couldn't open %s\n", path);
+    exit(-1);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    printf("couldn't stat %s\n", path);
+    exit(-1);
+  }
+
+  // not a regular file, or empty which mmap doesn't like
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    FILE *file = fdopen(fd, "rb");
+    assert(file != NULL);
+    Source source = read_source(file);
+    fclose(file);
+    return source;
+  }
+
+  void *chars = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (chars == MAP_FAILED) {
+    printf("couldn't map %s\n", path);
+    exit(-1);
+  }
+  // the lexer goes through it front to back exactly once
+  madvise(chars, st.st_size, MADV_SEQUENTIAL);
+
+  return (Source){
+      .chars = chars,
+      .len = st.st_size,
+      .mapped = true,
+  };
+}
+
+Source read_source(FILE *file) {
+  size_t len = 0, cap = READ_CHUNK_SIZE;
+  char *chars = malloc(cap);
+  assert(chars != NULL);
+
+  for (;;) {
+    len += fread(chars + len, 1, cap - len, file);
+    if (len < cap)
+      break;
+
+    cap *= 2;
+    chars = realloc(chars, cap);
+    assert(chars != NULL);
+  }
+  if (ferror(file)) {
+    puts("couldn't read script");
+    exit(-1);
+  }
+
+  return (Source){
+      .chars = chars,
+      .len = len,
+      .mapped = false,
+  };
+}
+
+void delete_source(Source *source) {
+  if (source->mapped)
+    munmap((void *)source->chars, source->len);
+  else
+    free((void *)source->chars);
+}
@@ -51,6 +51,13 @@ bool compare_type_def(TypeDef lhs, TypeDef rhs) {
   return false;
 }
 
+ValueType common_type_def(TypeDef lhs, TypeDef rhs) {
+  // optionals might be holding null instead
+  if (lhs.optional || rhs.optional || lhs.value != rhs.value)
+    return ValueType_Error;
+  return lhs.value;
+}
+
 TypeDef parse_type_def(Lexer *lexer) {
   Token token = lexer_peek(lexer);
   if (token.type != TokenType_Identifier) {
@@ -1,5 +1,7 @@
 #include "utility.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 bool compare_string(const char *lhs, size_t lhs_len, const char *rhs,
@@ -7,4 +9,25 @@ bool compare_string(const char *lhs, size_t lhs_len, const char *rhs,
   if (lhs_len != rhs_len)
     return false;
   return memcmp(lhs, rhs, lhs_len) == 0;
-}
\ No newline at end of file
+}
+
+uint32_t hash_string(const char *chars, size_t len) {
+  // fnv-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= 16777619u;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+uint64_t hash_bytes64(const void *bytes, size_t len) {
+  // fnv-1a again, 64 bit for when collisions actually matter
+  const uint8_t *data = bytes;
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
@@ -1,97 +1,83 @@
 #include "value.h"
+#include "heap.h"
 #include "type_def.h"
 #include "utility.h"
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-static uint32_t active_values = 0;
+// values never move between threads, so neither does counting them
+static _Thread_local uint32_t active_values = 0;
 
 uint32_t get_active_values() { return active_values; }
 
-Value new_null_value() {
-  return (Value){
-      .type = ValueType_Null,
-  };
-}
+#ifdef VALUE_NAN_BOXING
+static_assert(sizeof(Value) == sizeof(uint64_t), "Value must be one word");
 
-Value new_number_value(double number) {
+static Value new_object_value(Obj *object) {
+  uint64_t ptr = (uintptr_t)object;
+  assert((ptr & VALUE_OBJECT_BITS) == 0 &&
+         "pointer doesn't fit in a NaN payload");
   return (Value){
-      .type = ValueType_Number,
-      .number = number,
+      .bits = VALUE_OBJECT_BITS | ptr,
   };
 }
 
-Value new_boolean_value(bool boolean) {
-  return (Value){
-      .type = ValueType_Boolean,
-      .boolean = boolean,
-  };
+static Obj *value_as_object(Value value) {
+  return (Obj *)(uintptr_t)(value.bits & ~VALUE_OBJECT_BITS);
 }
 
-Value new_string_value_move(char *chars, uint32_t len) {
-  ObjString *string = malloc(sizeof(*string));
-  assert(string != NULL);
-  string->ref_count = 1;
-  string->len = len;
-  string->chars = chars;
-  active_values++;
+ValueType value_type(Value value) {
+  if ((value.bits & VALUE_QNAN) != VALUE_QNAN)
+    return ValueType_Number;
+  if ((value.bits & VALUE_OBJECT_BITS) == VALUE_OBJECT_BITS)
+    return ValueType_String; // the only kind of object for now
 
-  return (Value){
-      .type = ValueType_String,
-      .string = string,
-  };
+  switch (value.bits & ~VALUE_QNAN) {
+  case ValueTag_Null:
+    return ValueType_Null;
+  case ValueTag_False:
+  case ValueTag_True:
+    return ValueType_Boolean;
+  default:
+    return ValueType_Error;
+  }
 }
 
-Value new_string_value(const char *chars, uint32_t len) {
-  char *chars_copy = strndup(chars, len);
-  assert(chars_copy != NULL);
-  return new_string_value_move(chars_copy, len);
+bool is_value_primitive(Value value) {
+  return (value.bits & VALUE_OBJECT_BITS) != VALUE_OBJECT_BITS;
 }
 
-Value new_c_string_value(const char *str) {
-  return new_string_value(str, strlen(str));
+double value_as_number(Value value) {
+  assert(value_type(value) == ValueType_Number);
+  double number;
+  memcpy(&number, &value.bits, sizeof(number));
+  return number;
 }
 
-void reference_value(Value value) {
-  if (is_value_primitive(value))
-    return;
-
-  value.object->ref_count++;
+bool value_as_boolean(Value value) {
+  assert(value_type(value) == ValueType_Boolean);
+  return value.bits == (VALUE_QNAN | ValueTag_True);
 }
 
-void release_value(Value value) {
-  if (is_value_primitive(value))
-    return;
-
-  value.object->ref_count--;
-  if (value.object->ref_count == 0) {
-    active_values--;
-    switch (value.type) {
-    case ValueType_String:
-      free(value.string->chars);
-      break;
-    default:
-      break;
-    }
-
-    free(value.object);
-  }
+ObjString *value_as_string(Value value) {
+  assert(value_type(value) == ValueType_String);
+  return (ObjString *)value_as_object(value);
+}
+#else
+static Value new_object_value(Obj *object) {
+  return (Value){
+      .type = ValueType_String, // the only kind of object for now
+      .object = object,
+  };
 }
 
-Value copy_value(Value value) {
-  if (is_value_primitive(value))
-    return value;
+static Obj *value_as_object(Value value) { return value.object; }
 
-  switch (value.type) {
-  case ValueType_String:
-    return new_string_value(value.string->chars, value.string->len);
-  default:
-    assert(0);
-  }
-}
+ValueType value_type(Value value) { return value.type; }
 
 bool is_value_primitive(Value value) {
   switch (value.type) {
@@ -119,42 +105,248 @@ ObjString *value_as_string(Value value) {
   assert(value.type == ValueType_String);
   return value.string;
 }
+#endif
+
+// storage shared by strings built up through concatenation, each of them
+// sees the first len characters of it so appending past the end never
+// changes an existing string
+typedef struct StringBuffer {
+  uint32_t ref_count;
+  uint32_t len, cap; // cap doesn't count the room left for a nul
+  char chars[];
+} StringBuffer;
+
+enum { STRING_BUFFER_MIN_CAP = 64 };
+
+static StringBuffer *new_string_buffer(size_t cap) {
+  if (cap > UINT32_MAX - 1)
+    cap = UINT32_MAX - 1;
+
+  StringBuffer *buffer = heap_alloc(get_current_heap(),
+                                    sizeof(*buffer) + cap + 1);
+  buffer->ref_count = 0;
+  buffer->len = 0;
+  buffer->cap = cap;
+  return buffer;
+}
+
+static void release_string_buffer(StringBuffer *buffer) {
+  buffer->ref_count--;
+  if (buffer->ref_count == 0)
+    heap_free(buffer, sizeof(*buffer) + buffer->cap + 1);
+}
+
+static ObjString *alloc_string(size_t chars_size) {
+  return heap_alloc(get_current_heap(), sizeof(ObjString) + chars_size);
+}
+
+static ObjString *new_string(uint32_t len, uint32_t ref_count) {
+  ObjString *string = alloc_string(len + 1);
+  string->ref_count = ref_count;
+  string->len = len;
+  string->hash = 0;
+  string->interned = false;
+  string->buffer = NULL;
+  string->chars[len] = 0;
+  return string;
+}
+
+static void free_string(ObjString *string) {
+  size_t chars_size = 0;
+  if (string->buffer != NULL)
+    release_string_buffer(string->buffer);
+  else
+    chars_size = string->len + 1;
+
+  heap_free(string, sizeof(*string) + chars_size);
+}
+
+static void free_object(Value value) {
+  switch (value_type(value)) {
+  case ValueType_String:
+    free_string(value_as_string(value));
+    break;
+  default:
+    assert(0);
+    break;
+  }
+}
+
+Value new_blank_string_value(uint32_t len, char **chars) {
+  ObjString *string = new_string(len, 1);
+  *chars = string->chars;
+  active_values++;
+  return new_object_value((Obj *)string);
+}
+
+Value new_string_value(const char *chars, uint32_t len) {
+  char *string_chars;
+  Value value = new_blank_string_value(len, &string_chars);
+  memcpy(string_chars, chars, len);
+  return value;
+}
+
+Value new_c_string_value(const char *str) {
+  return new_string_value(str, strlen(str));
+}
+
+Value new_immortal_string_value(const char *chars, uint32_t len) {
+  ObjString *string = new_string(len, REF_COUNT_IMMORTAL);
+  memcpy(string->chars, chars, len);
+  // hashed up front, nothing ever writes to an immortal string afterwards so
+  // any number of threads can share it
+  string->hash = hash_string(chars, len);
+  return new_object_value((Obj *)string);
+}
+
+void delete_immortal_value(Value value) {
+  if (is_value_primitive(value))
+    return;
+
+  assert(value_as_object(value)->ref_count == REF_COUNT_IMMORTAL);
+  free_object(value);
+}
+
+Value new_string_object_value(ObjString *string) {
+  return new_object_value((Obj *)string);
+}
+
+void reference_value(Value value) {
+  if (is_value_primitive(value))
+    return;
+
+  // saturates, an object that runs out of counts is leaked instead of being
+  // freed while still in use
+  Obj *object = value_as_object(value);
+  if (object->ref_count != REF_COUNT_IMMORTAL)
+    object->ref_count++;
+}
+
+void release_value(Value value) {
+  if (is_value_primitive(value))
+    return;
+
+  Obj *object = value_as_object(value);
+  if (object->ref_count == REF_COUNT_IMMORTAL)
+    return;
+
+  assert(object->ref_count != 0);
+  object->ref_count--;
+  if (object->ref_count == 0) {
+    active_values--;
+    free_object(value);
+  }
+}
+
+Value copy_value(Value value) {
+  // objects are immutable, so a copy can just share the original
+  reference_value(value);
+  return value;
+}
+
+const char *string_chars(const ObjString *string) {
+  return string->buffer != NULL ? string->buffer->chars : string->chars;
+}
 
 const char *value_as_c_string(Value value) {
-  return value_as_string(value)->chars;
+  ObjString *string = value_as_string(value);
+  StringBuffer *buffer = string->buffer;
+  if (buffer == NULL)
+    return string->chars;
+
+  // something was appended past this one, give it a buffer of its own so
+  // there's somewhere to put the nul
+  if (buffer->len != string->len) {
+    StringBuffer *own = new_string_buffer(string->len);
+    memcpy(own->chars, buffer->chars, string->len);
+    own->len = string->len;
+    own->ref_count = 1;
+
+    release_string_buffer(buffer);
+    string->buffer = buffer = own;
+  }
+
+  buffer->chars[buffer->len] = 0;
+  return buffer->chars;
+}
+
+uint32_t string_hash(ObjString *string) {
+  if (string->hash == 0)
+    string->hash = hash_string(string_chars(string), string->len);
+  return string->hash;
 }
 
 bool value_compare(Value lhs, Value rhs) {
-  if (lhs.type != rhs.type)
+  ValueType type = value_type(lhs);
+  if (type != value_type(rhs))
     return false;
 
-  switch (lhs.type) {
+  switch (type) {
   case ValueType_Error:
   case ValueType_Void:
   case ValueType_Null:
     return true;
   case ValueType_Number:
-    return lhs.number == rhs.number;
+    return value_as_number(lhs) == value_as_number(rhs);
   case ValueType_Boolean:
-    return lhs.boolean == rhs.boolean;
+    return value_as_boolean(lhs) == value_as_boolean(rhs);
   case ValueType_String:
-    return compare_string(lhs.string->chars, lhs.string->len, rhs.string->chars,
-                          rhs.string->len);
+    return string_compare(value_as_string(lhs), value_as_string(rhs));
   }
   return false;
 }
 
-Value value_concat(Value lhs_value, Value rhs_value) {
-  assert(lhs_value.type == ValueType_String &&
-         rhs_value.type == ValueType_String);
-  ObjString *lhs = lhs_value.string, *rhs = rhs_value.string;
+bool string_compare(const ObjString *lhs, const ObjString *rhs) {
+  if (lhs == rhs)
+    return true;
+  // interned strings are unique, so two different ones never match
+  if (lhs->interned && rhs->interned)
+    return false;
+  if (lhs->hash != 0 && rhs->hash != 0 && lhs->hash != rhs->hash)
+    return false;
+  return compare_string(string_chars(lhs), lhs->len, string_chars(rhs),
+                        rhs->len);
+}
 
-  uint32_t len = lhs->len + rhs->len;
-  char *chars = malloc(len + 1);
-  assert(chars != NULL);
-  memcpy(chars, lhs->chars, lhs->len);
-  memcpy(chars + lhs->len, rhs->chars, rhs->len);
-  chars[len] = 0;
+bool value_concat(Value lhs_value, Value rhs_value, Value *out) {
+  ObjString *lhs = value_as_string(lhs_value);
+  ObjString *rhs = value_as_string(rhs_value);
 
-  return new_string_value_move(chars, len);
-}
\ No newline at end of file
+  // buffers hold one more byte than their cap for the terminator
+  size_t len = (size_t)lhs->len + rhs->len;
+  if (len > UINT32_MAX - 1)
+    return false;
+  if (len <= SMALL_STRING_MAX) {
+    char *chars;
+    *out = new_blank_string_value(len, &chars);
+    memcpy(chars, string_chars(lhs), lhs->len);
+    memcpy(chars + lhs->len, string_chars(rhs), rhs->len);
+    return true;
+  }
+
+  // append in place when lhs is the longest string its buffer holds and
+  // there's room left, otherwise start a new buffer with space to grow into
+  StringBuffer *buffer = lhs->buffer;
+  if (buffer == NULL || buffer->len != lhs->len || buffer->cap < len) {
+    size_t cap = len * 2;
+    buffer = new_string_buffer(cap < STRING_BUFFER_MIN_CAP
+                                   ? STRING_BUFFER_MIN_CAP
+                                   : cap);
+    memcpy(buffer->chars, string_chars(lhs), lhs->len);
+    buffer->len = lhs->len;
+  }
+  // rhs may live in the same buffer, but only below buffer->len
+  memcpy(buffer->chars + buffer->len, string_chars(rhs), rhs->len);
+  buffer->len = len;
+
+  ObjString *string = alloc_string(0);
+  string->ref_count = 1;
+  string->len = len;
+  string->hash = 0;
+  string->interned = false;
+  string->buffer = buffer;
+  buffer->ref_count++;
+  active_values++;
+  *out = new_object_value((Obj *)string);
+  return true;
+}
@@ -1,6 +1,7 @@
 #include "vm.h"
 #include "bytecode.h"
 #include "chunk.h"
+#include "heap.h"
 #include "registry.h"
 #include "type_def.h"
 #include "value.h"
@@ -8,16 +9,28 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-static uint8_t read_u8(Vm *vm) { return read_chunk_u8(vm->chunk, &vm->pc); }
-static uint16_t read_u16(Vm *vm) { return read_chunk_u16(vm->chunk, &vm->pc); }
-static double read_f64(Vm *vm) { return read_chunk_f64(vm->chunk, &vm->pc); }
-
+// for results replacing operands that were just popped, there's always room
 static void push(Vm *vm, Value value) {
-  assert(vm->sp < 128);
+  assert(vm->sp < vm->stack_cap);
   vm->stack[vm->sp++] = value;
 }
 
+// false once the stack can't grow any further
+static bool grow_stack(Vm *vm) {
+  if (vm->stack_cap >= vm->stack_max)
+    return false;
+
+  size_t cap = vm->stack_cap * 2;
+  if (cap > vm->stack_max)
+    cap = vm->stack_max;
+  vm->stack = realloc(vm->stack, cap * sizeof(*vm->stack));
+  assert(vm->stack != NULL);
+  vm->stack_cap = cap;
+  return true;
+}
+
 static Value peek_at(Vm *vm, size_t idx) {
   assert(idx < vm->sp);
   return vm->stack[idx];
@@ -31,74 +44,296 @@ static Value pop(Vm *vm) {
 }
 
 Vm new_vm(const Chunk *chunk, const Registry *registry) {
-  return (Vm){
+  Vm vm = {
       .chunk = chunk,
       .registry = registry,
+      .program = decode_chunk(chunk),
 
-      .stack = {},
+#ifdef VM_THREADED_DISPATCH
+      .handlers = NULL,
+#endif
+
+      .stack = malloc(VM_STACK_INITIAL * sizeof(*vm.stack)),
       .sp = 0,
+      .stack_cap = VM_STACK_INITIAL,
+      .stack_max = VM_STACK_MAX,
       .pc = 0,
+
+      .error = NULL,
+      .result = new_null_value(),
+
+      .heap = new_heap(),
+      .executed = 0,
   };
+  assert(vm.stack != NULL);
+  return vm;
+}
+
+void delete_vm(Vm *vm) {
+  delete_heap(vm->heap);
+  free(vm->stack);
+  delete_program(&vm->program);
+#ifdef VM_THREADED_DISPATCH
+  free(vm->handlers);
+#endif
+}
+
+void reset_vm(Vm *vm) {
+  for (size_t i = 0; i < vm->sp; i++)
+    release_value(vm->stack[i]);
+  release_value(vm->result);
+
+  vm->sp = 0;
+  vm->pc = 0;
+  vm->error = NULL;
+  vm->result = new_null_value();
+}
+
+// the compiled code trusts args to be what they were declared as, so this is
+// the only place that gets checked
+static bool is_arg_type(TypeDef def, Value value) {
+  ValueType type = value_type(value);
+  return type == def.value || (def.optional && type == ValueType_Null);
 }
 
+Value run_vm_args(Vm *vm, const Value *args, size_t args_num) {
+  assert(vm->sp == 0 && vm->pc == 0);
+  if (args_num != vm->chunk->args_num) {
+    vm->error = "wrong number of arguments";
+    return vm->result;
+  }
+  for (size_t i = 0; i < args_num; i++) {
+    if (!is_arg_type(vm->chunk->arg_types[i], args[i])) {
+      vm->error = "wrong argument type";
+      return vm->result;
+    }
+  }
+
+  while (vm->stack_cap < args_num) {
+    if (!grow_stack(vm)) {
+      vm->error = "stack overflow";
+      return vm->result;
+    }
+  }
+  for (size_t i = 0; i < args_num; i++)
+    vm->stack[i] = copy_value(args[i]);
+  vm->sp = args_num;
+  return run_vm(vm);
+}
+
+#ifdef VM_STATS
+#define COUNT_INSTRUCTION() executed++
+#else
+#define COUNT_INSTRUCTION() (void)0
+#endif
+
+// the instruction handlers below are shared by both dispatch engines, these
+// macros paper over how each of them moves on to the next instruction
+#ifdef VM_THREADED_DISPATCH
+#define VM_CASE(enum_name) op_##enum_name:
+#define VM_NEXT()                                                              \
+  do {                                                                         \
+    COUNT_INSTRUCTION();                                                       \
+    goto *handlers[++pc];                                                      \
+  } while (0)
+#else
+#define VM_CASE(enum_name) case Bytecode_##enum_name:
+#define VM_NEXT() continue
+#endif
+
+#define OPERAND() (code[pc].operand)
+#define ARG() (code[pc].arg)
+#define CONSTANT() (numbers[code[pc].constant])
+// the following VM_NEXT steps onto the target
+#define VM_JUMP(target) (pc = (target)-1)
+// the only check on the hot path is whether the stack is full
+#define PUSH(value)                                                            \
+  do {                                                                         \
+    Value pushed = (value);                                                    \
+    if (vm->sp == vm->stack_cap && !grow_stack(vm)) {                          \
+      release_value(pushed);                                                   \
+      goto stack_overflow;                                                     \
+    }                                                                          \
+    vm->stack[vm->sp++] = pushed;                                              \
+  } while (0)
+
 Value run_vm(Vm *vm) {
 #define BINARY_OP(enum_name, op, result_type)                                  \
-  case Bytecode_##enum_name: {                                                 \
-    double rhs = value_as_number(pop(vm));                                     \
-    double lhs = value_as_number(pop(vm));                                     \
+  VM_CASE(enum_name) {                                                         \
+    double rhs = proven_number(pop(vm));                                       \
+    double lhs = proven_number(pop(vm));                                       \
                                                                                \
     push(vm, new_##result_type##_value(lhs op rhs));                           \
-    break;                                                                     \
+    VM_NEXT();                                                                 \
+  }
+#define JUMP_IF_NOT_OP(enum_name, op)                                          \
+  VM_CASE(JumpIfNot##enum_name) {                                              \
+    double rhs = proven_number(pop(vm));                                       \
+    double lhs = proven_number(pop(vm));                                       \
+    if (!(lhs op rhs))                                                         \
+      VM_JUMP(OPERAND());                                                      \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(JumpIfNot##enum_name##LocalConst) {                                  \
+    double lhs = proven_number(peek_at(vm, ARG()));                            \
+    if (!(lhs op CONSTANT()))                                                  \
+      VM_JUMP(OPERAND());                                                      \
+    VM_NEXT();                                                                 \
   }
+// primitives compare by value and never need releasing
+#define PRIMITIVE_EQUALITY_OP(type_name, proven_fn)                            \
+  VM_CASE(Equal##type_name) {                                                  \
+    bool equal = proven_fn(pop(vm)) == proven_fn(pop(vm));                     \
+    push(vm, new_boolean_value(equal));                                        \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(NotEqual##type_name) {                                               \
+    bool equal = proven_fn(pop(vm)) == proven_fn(pop(vm));                     \
+    push(vm, new_boolean_value(!equal));                                       \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(JumpIfNotEqual##type_name) {                                         \
+    if (proven_fn(pop(vm)) != proven_fn(pop(vm)))                              \
+      VM_JUMP(OPERAND());                                                      \
+    VM_NEXT();                                                                 \
+  }                                                                            \
+  VM_CASE(JumpIfEqual##type_name) {                                            \
+    if (proven_fn(pop(vm)) == proven_fn(pop(vm)))                              \
+      VM_JUMP(OPERAND());                                                      \
+    VM_NEXT();                                                                 \
+  }
+
+  Heap *previous_heap = set_current_heap(vm->heap);
+  const Instruction *code = vm->program.code;
+  const double *numbers = vm->program.numbers;
+  size_t pc = vm->pc;
+  size_t executed = 0;
+
+#ifdef VM_THREADED_DISPATCH
+#define LABEL(enum_name) [Bytecode_##enum_name] = &&op_##enum_name
+  static const void *const labels[] = {
+      LABEL(PushNull),     LABEL(PushNumber),
+      LABEL(PushTrue),     LABEL(PushFalse),
+      LABEL(PushString),   LABEL(Copy),
+      LABEL(Pop),          LABEL(PopN),
+
+      LABEL(Load),         LABEL(Store),
+      LABEL(StorePop),
+
+      LABEL(NativeCall),
+
+      LABEL(Negate),       LABEL(Not),
+
+      LABEL(Add),          LABEL(Subtract),
+      LABEL(Multiply),     LABEL(Divide),
+
+      LABEL(Equal),        LABEL(NotEqual),
+      LABEL(Less),         LABEL(LessEqual),
+      LABEL(Greater),      LABEL(GreaterEqual),
+      LABEL(EqualNum),     LABEL(NotEqualNum),
+      LABEL(EqualBool),    LABEL(NotEqualBool),
+      LABEL(EqualStr),     LABEL(NotEqualStr),
+
+      LABEL(Concat),
+
+      LABEL(Jump),         LABEL(JumpBack),
+      LABEL(JumpIfFalse),  LABEL(JumpIfTrue),
+      LABEL(JumpIfFalseRetain), LABEL(JumpIfTrueRetain),
+
+      LABEL(AddLocalConst), LABEL(IncLocalAndLoop),
+
+      LABEL(JumpIfNotEqual), LABEL(JumpIfEqual),
+      LABEL(JumpIfNotEqualNum), LABEL(JumpIfEqualNum),
+      LABEL(JumpIfNotEqualBool), LABEL(JumpIfEqualBool),
+      LABEL(JumpIfNotEqualStr), LABEL(JumpIfEqualStr),
+      LABEL(JumpIfNotLess), LABEL(JumpIfNotLessEqual),
+      LABEL(JumpIfNotGreater), LABEL(JumpIfNotGreaterEqual),
+
+      LABEL(JumpIfNotLessLocalConst), LABEL(JumpIfNotLessEqualLocalConst),
+      LABEL(JumpIfNotGreaterLocalConst),
+      LABEL(JumpIfNotGreaterEqualLocalConst),
 
-  while (vm->pc < vm->chunk->size) {
-    Bytecode instruction = read_u8(vm);
-    switch (instruction) {
-    case Bytecode_PushNull:
-      push(vm, new_null_value());
-      break;
-    case Bytecode_PushNumber:
-      push(vm, new_number_value(read_f64(vm)));
-      break;
-    case Bytecode_PushTrue:
-      push(vm, new_boolean_value(true));
-      break;
-    case Bytecode_PushFalse:
-      push(vm, new_boolean_value(false));
-      break;
-    case Bytecode_PushString: {
-      uint16_t idx = read_u16(vm);
-      assert(idx < vm->chunk->strings_num);
-      ChunkString string = vm->chunk->strings[idx];
-      push(vm, new_string_value(string.chars, string.len));
-      break;
-    }
-    case Bytecode_Copy:
-      push(vm, copy_value(peek(vm)));
-      break;
-    case Bytecode_Pop:
+      LABEL(Return),       LABEL(Halt),
+  };
+#undef LABEL
+
+  // resolve the handler of every instruction up front
+  if (vm->handlers == NULL) {
+    vm->handlers = malloc(vm->program.size * sizeof(*vm->handlers));
+    assert(vm->handlers != NULL);
+    for (size_t i = 0; i < vm->program.size; i++)
+      vm->handlers[i] = labels[code[i].op];
+  }
+  const void *const *handlers = vm->handlers;
+  COUNT_INSTRUCTION();
+  goto *handlers[pc];
+#else
+  for (;; pc++) {
+    COUNT_INSTRUCTION();
+    switch (code[pc].op) {
+#endif
+    VM_CASE(PushNull) {
+      PUSH(new_null_value());
+      VM_NEXT();
+    }
+    VM_CASE(PushNumber) {
+      PUSH(new_number_value(CONSTANT()));
+      VM_NEXT();
+    }
+    VM_CASE(PushTrue) {
+      PUSH(new_boolean_value(true));
+      VM_NEXT();
+    }
+    VM_CASE(PushFalse) {
+      PUSH(new_boolean_value(false));
+      VM_NEXT();
+    }
+    VM_CASE(PushString) {
+      PUSH(vm->chunk->strings[OPERAND()]);
+      VM_NEXT();
+    }
+    VM_CASE(Copy) {
+      PUSH(copy_value(peek(vm)));
+      VM_NEXT();
+    }
+    VM_CASE(Pop) {
       release_value(pop(vm));
-      break;
+      VM_NEXT();
+    }
+    VM_CASE(PopN) {
+      for (uint16_t i = 0; i < ARG(); i++)
+        release_value(pop(vm));
+      VM_NEXT();
+    }
 
-    case Bytecode_Load: {
-      Value value = peek_at(vm, read_u8(vm));
-      push(vm, copy_value(value));
-      break;
+    VM_CASE(Load) {
+      Value value = peek_at(vm, OPERAND());
+      PUSH(copy_value(value));
+      VM_NEXT();
     }
-    case Bytecode_Store: {
-      uint8_t idx = read_u8(vm);
+    VM_CASE(Store) {
+      uint32_t idx = OPERAND();
       assert(idx < vm->sp);
 
       release_value(vm->stack[idx]);
       vm->stack[idx] = copy_value(peek(vm));
-      break;
+      VM_NEXT();
     }
+    VM_CASE(StorePop) {
+      uint32_t idx = OPERAND();
+      assert(idx + 1 < vm->sp);
 
-    case Bytecode_NativeCall: {
-      uint16_t idx = read_u16(vm);
+      // the value moves into the slot, no need to count another reference
+      release_value(vm->stack[idx]);
+      vm->stack[idx] = pop(vm);
+      VM_NEXT();
+    }
+
+    VM_CASE(NativeCall) {
+      uint32_t idx = OPERAND();
       assert(idx < vm->registry->native_fns_num);
       const NativeFn *native_fn = &vm->registry->native_fns[idx];
-      uint8_t argc = read_u8(vm);
+      uint16_t argc = ARG();
       assert(vm->sp >= argc && argc >= native_fn->args_num);
 
       Value *argv = vm->stack + vm->sp - argc;
@@ -109,99 +344,200 @@ Value run_vm(Vm *vm) {
       vm->sp -= argc;
 
       if (!is_type_def_void(native_fn->return_type))
-        push(vm, result);
+        PUSH(result);
       else
         release_value(result);
-      break;
+      VM_NEXT();
     }
 
-    case Bytecode_Negate: {
-      double operand = value_as_number(pop(vm));
+    VM_CASE(Negate) {
+      double operand = proven_number(pop(vm));
       push(vm, new_number_value(-operand));
-      break;
+      VM_NEXT();
     }
-    case Bytecode_Not: {
-      bool operand = value_as_boolean(pop(vm));
+    VM_CASE(Not) {
+      bool operand = proven_boolean(pop(vm));
       push(vm, new_boolean_value(!operand));
-      break;
+      VM_NEXT();
     }
 
-      BINARY_OP(Add, +, number)
-      BINARY_OP(Subtract, -, number)
-      BINARY_OP(Multiply, *, number)
-      BINARY_OP(Divide, /, number)
+    BINARY_OP(Add, +, number)
+    BINARY_OP(Subtract, -, number)
+    BINARY_OP(Multiply, *, number)
+    BINARY_OP(Divide, /, number)
 
-    case Bytecode_Equal: {
+    VM_CASE(Equal) {
       Value rhs = pop(vm);
       Value lhs = pop(vm);
       push(vm, new_boolean_value(value_compare(lhs, rhs)));
 
       release_value(rhs);
       release_value(lhs);
-      break;
+      VM_NEXT();
     }
-    case Bytecode_NotEqual: {
+    VM_CASE(NotEqual) {
       Value rhs = pop(vm);
       Value lhs = pop(vm);
       push(vm, new_boolean_value(!value_compare(lhs, rhs)));
 
       release_value(rhs);
       release_value(lhs);
-      break;
+      VM_NEXT();
+    }
+    BINARY_OP(Less, <, boolean)
+    BINARY_OP(LessEqual, <=, boolean)
+    BINARY_OP(Greater, >, boolean)
+    BINARY_OP(GreaterEqual, >=, boolean)
+
+    PRIMITIVE_EQUALITY_OP(Num, proven_number)
+    PRIMITIVE_EQUALITY_OP(Bool, proven_boolean)
+    VM_CASE(EqualStr) {
+      Value rhs = pop(vm);
+      Value lhs = pop(vm);
+      bool equal = string_compare(proven_string(lhs), proven_string(rhs));
+      push(vm, new_boolean_value(equal));
+
+      release_value(rhs);
+      release_value(lhs);
+      VM_NEXT();
+    }
+    VM_CASE(NotEqualStr) {
+      Value rhs = pop(vm);
+      Value lhs = pop(vm);
+      bool equal = string_compare(proven_string(lhs), proven_string(rhs));
+      push(vm, new_boolean_value(!equal));
+
+      release_value(rhs);
+      release_value(lhs);
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfNotEqualStr) {
+      Value rhs = pop(vm);
+      Value lhs = pop(vm);
+      if (!string_compare(proven_string(lhs), proven_string(rhs)))
+        VM_JUMP(OPERAND());
+
+      release_value(rhs);
+      release_value(lhs);
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfEqualStr) {
+      Value rhs = pop(vm);
+      Value lhs = pop(vm);
+      if (string_compare(proven_string(lhs), proven_string(rhs)))
+        VM_JUMP(OPERAND());
+
+      release_value(rhs);
+      release_value(lhs);
+      VM_NEXT();
     }
-      BINARY_OP(Less, <, boolean)
-      BINARY_OP(LessEqual, <=, boolean)
-      BINARY_OP(Greater, >, boolean)
-      BINARY_OP(GreaterEqual, >=, boolean)
 
-    case Bytecode_Concat: {
+    VM_CASE(Concat) {
       Value rhs = pop(vm);
       Value lhs = pop(vm);
 
-      push(vm, value_concat(lhs, rhs));
+      Value result;
+      bool fits = value_concat(lhs, rhs, &result);
       release_value(rhs);
       release_value(lhs);
-      break;
-    }
-
-    case Bytecode_Jump:
-      vm->pc += read_u16(vm);
-      break;
-    case Bytecode_JumpBack:
-      vm->pc -= read_u16(vm);
-      break;
-    case Bytecode_JumpIfFalse: {
-      uint16_t offset = read_u16(vm);
-      if (!value_as_boolean(pop(vm)))
-        vm->pc += offset;
-      break;
-    }
-    case Bytecode_JumpIfTrue: {
-      uint16_t offset = read_u16(vm);
-      if (value_as_boolean(pop(vm)))
-        vm->pc += offset;
-      break;
-    }
-    case Bytecode_JumpIfFalseRetain: {
-      uint16_t offset = read_u16(vm);
-      if (!value_as_boolean(peek(vm)))
-        vm->pc += offset;
+      if (!fits) {
+        vm->error = "string too long";
+        goto halt;
+      }
+      push(vm, result);
+      VM_NEXT();
+    }
+
+    VM_CASE(Jump) {
+      VM_JUMP(OPERAND());
+      VM_NEXT();
+    }
+    VM_CASE(JumpBack) {
+      VM_JUMP(OPERAND());
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfFalse) {
+      if (!proven_boolean(pop(vm)))
+        VM_JUMP(OPERAND());
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfTrue) {
+      if (proven_boolean(pop(vm)))
+        VM_JUMP(OPERAND());
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfFalseRetain) {
+      if (!proven_boolean(peek(vm)))
+        VM_JUMP(OPERAND());
       else
         pop(vm);
-      break;
+      VM_NEXT();
     }
-    case Bytecode_JumpIfTrueRetain: {
-      uint16_t offset = read_u16(vm);
-      if (value_as_boolean(peek(vm)))
-        vm->pc += offset;
+    VM_CASE(JumpIfTrueRetain) {
+      if (proven_boolean(peek(vm)))
+        VM_JUMP(OPERAND());
       else
         pop(vm);
-      break;
+      VM_NEXT();
     }
+
+    VM_CASE(AddLocalConst) {
+      uint16_t idx = ARG();
+      double local = proven_number(peek_at(vm, idx));
+      vm->stack[idx] = new_number_value(local + CONSTANT());
+      VM_NEXT();
+    }
+    VM_CASE(IncLocalAndLoop) {
+      uint16_t idx = ARG();
+      double local = proven_number(peek_at(vm, idx));
+      vm->stack[idx] = new_number_value(local + CONSTANT());
+      VM_JUMP(OPERAND());
+      VM_NEXT();
+    }
+
+    VM_CASE(JumpIfNotEqual) {
+      Value rhs = pop(vm);
+      Value lhs = pop(vm);
+      if (!value_compare(lhs, rhs))
+        VM_JUMP(OPERAND());
+
+      release_value(rhs);
+      release_value(lhs);
+      VM_NEXT();
+    }
+    VM_CASE(JumpIfEqual) {
+      Value rhs = pop(vm);
+      Value lhs = pop(vm);
+      if (value_compare(lhs, rhs))
+        VM_JUMP(OPERAND());
+
+      release_value(rhs);
+      release_value(lhs);
+      VM_NEXT();
+    }
+    JUMP_IF_NOT_OP(Less, <)
+    JUMP_IF_NOT_OP(LessEqual, <=)
+    JUMP_IF_NOT_OP(Greater, >)
+    JUMP_IF_NOT_OP(GreaterEqual, >=)
+
+    VM_CASE(Return) {
+      vm->result = pop(vm);
+      goto halt;
+    }
+    VM_CASE(Halt) { goto halt; }
+#ifndef VM_THREADED_DISPATCH
     }
   }
+#endif
+#undef PRIMITIVE_EQUALITY_OP
+#undef JUMP_IF_NOT_OP
+#undef BINARY_OP
 
-  // assert(vm->sp == 1);
-  return new_null_value();
-  // return pop(vm);
-}
\ No newline at end of file
+stack_overflow:
+  vm->error = "stack overflow";
+halt:
+  vm->pc = pc;
+  vm->executed += executed;
+  set_current_heap(previous_heap);
+  return vm->result;
+}
@@ -0,0 +1,11 @@
+let a = "ab";
+let b = "a" + "b";
+let t = true;
+let n = 3;
+if a == b { print("str eq"); }
+if a != "x" { print("str ne"); }
+if t == (n > 2) { print("bool eq"); }
+if n == 3 { print("num eq"); }
+print(a == b);
+print(t != false);
+print(n != 3);
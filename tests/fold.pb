@@ -0,0 +1,28 @@
+let n = 5;
+let m = n;
+let s = "hi";
+let t = s + "";
+let flag = true;
+let zero = -0;
+print(n * 1, m / 1, m - 0, t, zero + 0, zero - 0, zero * 1);
+let c = 0;
+(c) = 3;
+print(c);
+{ let k = 1; print(k); }
+{ let k = 2; k = k + 1; print(k); }
+if false { print("dead"); } else { print("else live"); }
+if true { print("live"); } else { print("dead else"); }
+if flag == false { print("no"); } else { print("flag not false"); }
+if !(!flag) && true { print("double not"); }
+let total = 0;
+for i in 0 -> n { total = total + i; if i == 3 { break; print("after break"); } }
+print("total", total);
+let w = 0;
+while true { w = w + 1; if w > 4 { break; } }
+print("w", w);
+while false { print("never"); let q = 1; break; }
+let calls = 0;
+print(tostring(1) == "1" || true);
+print(false || flag, flag && false);
+return n + 1;
+print("after return");
@@ -0,0 +1,3 @@
+print(10000000000000000000000000000000000000000000000000000000000000000000000);
+print(0.00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000005);
+print(12.5);
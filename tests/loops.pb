@@ -0,0 +1,25 @@
+let total = 0;
+for i in 0 -> 10 {
+  total = total + i;
+}
+print("sum", total);
+for i in 10 => 0 by -2 {
+  print(i);
+}
+for i in 5 -> 1 {
+  if i == 3 { continue; }
+  print("down", i);
+}
+let n = 0;
+while n < 100 {
+  n = n + 7;
+  if n > 50 { break; }
+}
+print("n", n);
+let j = 0;
+while true {
+  let k = j * 2;
+  j = j + 1;
+  if j >= 3 { break; }
+  print("k", k);
+}
@@ -0,0 +1,18 @@
+let a = 3;
+let b = -a + 10 / 4 - 2 * (1 + 1);
+print(a, b, null, true, false);
+let c = a < b || a >= 3;
+print(c, !c);
+check_number(a);
+check_number(null);
+let m = 1;
+for i in 1 => 6 { m = m * i; }
+print("fact", m);
+for i in 0 -> 3 {
+  for j in 0 -> 3 {
+    if j == i { break; }
+    print(i, j);
+  }
+}
+let w = 10;
+while w > 0 { w = w - 3; if w == 4 { continue; } print("w", w); }
@@ -0,0 +1,12 @@
+let s = "start-of-a-long-string";
+let keep = s;
+for i in 0 -> 10 { s = s + "+" + tostring(i); }
+let branch = keep + "!";
+let snap = s;
+s = s + "tail";
+print(keep, branch);
+print(snap);
+print(s, snap == s, append(snap, "tail") == s);
+print(tonumber(snap + "") == tonumber("x"));
+let d = s + s;
+print(d);
@@ -0,0 +1,9 @@
+#!/bin/sh
+# usage: run_test.sh <pb> <script> <expected output> [pb flags...]
+# runs the script and diffs what it prints, minus the disassembly listing,
+# against the expected output
+pb=$1 script=$2 expected=$3
+shift 3
+tab=$(printf '\t')
+output=$("$pb" "$@" "$script") || exit 1
+printf '%s\n' "$output" | grep -v "^[0-9]*$tab| " | diff -u "$expected" -
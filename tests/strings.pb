@@ -0,0 +1,19 @@
+let s = "a";
+let t = s;
+for i in 0 -> 5 {
+  s = s + tostring(i);
+}
+print(s, t);
+let u = append(s, "!");
+print(u, s == u, s != u, t == "a");
+let x = "tag";
+if x == "tag" && !(x != "tag") { print("eq ok"); }
+if x == "nope" || false { print("bad"); } else { print("or ok"); }
+print(tonumber("12.5") * 2);
+let r = "";
+for i in 0 => 20 { r = r + "x"; }
+print(r);
+{
+  let inner = "scoped";
+  print(inner);
+}